@@ -22,6 +22,8 @@
 #include "stream.hpp"
 #include <string>
 #include <thread>
+#include <atomic>
+#include <vector>
 #include <iostream>
 #include <alsa/asoundlib.h>
 
@@ -35,17 +37,15 @@ namespace AV
       {
          public:
             DECL_SMART(ALSA<T>);
-            ALSA(unsigned channels, unsigned samplerate, const std::string& device = "default") : runnable(true), pcm(nullptr), params(nullptr), fps(samplerate)
+            ALSA(unsigned channels, unsigned samplerate, const DeviceOptions& opts = DeviceOptions()) : runnable(true), pcm(nullptr), params(nullptr), fps(samplerate), chan(channels), period(256), buffer(256), mmap(false), thread_active(false), cached_delay(0.0f)
             {
-               int rc = snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+               int rc = snd_pcm_open(&pcm, opts.device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
                if (rc < 0)
                {
                   runnable = false;
                   throw DeviceException(General::join("Unable to open PCM device ", snd_strerror(rc)));
                }
 
-               snd_pcm_format_t fmt = type_to_format(T());
-
                if (snd_pcm_hw_params_malloc(&params) < 0)
                {
                   runnable = false;
@@ -53,21 +53,50 @@ namespace AV
                }
 
                runnable = false;
+               if (opts.mmap)
+               {
+                  mmap = setup(channels, samplerate, SND_PCM_ACCESS_MMAP_INTERLEAVED, opts) >= 0;
+                  if (!mmap)
+                     std::cerr << "ALSA device doesn't do mmap, falling back to writei()." << std::endl;
+               }
+
+               if (!mmap && (rc = setup(channels, samplerate, SND_PCM_ACCESS_RW_INTERLEAVED, opts)) < 0)
+                  throw DeviceException(General::join("Unable to install HW params: ", snd_strerror(rc)));
+
+               snd_pcm_uframes_t period_size;
+               if (snd_pcm_hw_params_get_period_size(params, &period_size, nullptr) >= 0 && period_size > 0)
+                  period = period_size;
+               if (snd_pcm_hw_params_get_buffer_size(params, &buffer) < 0 || buffer < period)
+                  buffer = period;
+
+               // Start once all but one period is queued, and wake up writers a period at a time.
+               snd_pcm_sw_params_t *sw_params;
+               if (snd_pcm_sw_params_malloc(&sw_params) < 0)
+                  throw DeviceException("Failed to allocate memory.");
+
                if (
-                     (snd_pcm_hw_params_any(pcm, params) < 0) ||
-                     (snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) ||
-                     (snd_pcm_hw_params_set_channels(pcm, params, channels) < 0) ||
-                     (snd_pcm_hw_params_set_format(pcm, params, fmt) < 0) ||
-                     (snd_pcm_hw_params_set_rate(pcm, params, samplerate, 0) < 0) ||
-                     ((rc = snd_pcm_hw_params(pcm, params)) < 0)
+                     ((rc = snd_pcm_sw_params_current(pcm, sw_params)) < 0) ||
+                     ((rc = snd_pcm_sw_params_set_start_threshold(pcm, sw_params, std::max(buffer - period, period))) < 0) ||
+                     ((rc = snd_pcm_sw_params_set_avail_min(pcm, sw_params, period)) < 0) ||
+                     ((rc = snd_pcm_sw_params(pcm, sw_params)) < 0)
                   )
-                  throw DeviceException(General::join("Unable to install HW params: ", snd_strerror(rc)));
+               {
+                  snd_pcm_sw_params_free(sw_params);
+                  throw DeviceException(General::join("Unable to install SW params: ", snd_strerror(rc)));
+               }
+               snd_pcm_sw_params_free(sw_params);
+
+               std::cerr << "ALSA: " << (mmap ? "mmap" : "writei") << ", " << chan << " channels at " << fps << " Hz, buffer " <<
+                  buffer_time() * 1000.0 << " ms, period " << period_time() * 1000.0 << " ms." << std::endl;
+               if (fps != samplerate || chan != channels)
+                  std::cerr << "ALSA: Device can't do " << channels << " channels at " << samplerate << " Hz, converting." << std::endl;
 
                runnable = true;
             }
 
             ~ALSA()
             {
+               stop_thread();
                if (params)
                   snd_pcm_hw_params_free(params);
                if (pcm)
@@ -79,11 +108,11 @@ namespace AV
 
             size_t write(const T* in, size_t samples)
             {
-               if (!runnable)
+               if (!runnable || this->callback_active())
                   return 0;
 
                snd_pcm_sframes_t frames = snd_pcm_bytes_to_frames(pcm, samples * sizeof(T));
-               snd_pcm_sframes_t rc = snd_pcm_writei(pcm, in, frames);
+               snd_pcm_sframes_t rc = mmap ? snd_pcm_mmap_writei(pcm, in, frames) : snd_pcm_writei(pcm, in, frames);
                if (rc == -EPIPE || rc == -EINTR || rc == -ESTRPIPE)
                {
                   if (snd_pcm_recover(pcm, rc, 1) < 0)
@@ -102,6 +131,9 @@ namespace AV
 
             size_t write_avail()
             {
+               if (!runnable || this->callback_active())
+                  return 0;
+
                snd_pcm_sframes_t rc = snd_pcm_avail(pcm);
                if (rc < 0)
                {
@@ -114,6 +146,8 @@ namespace AV
 
             void pause()
             {
+               stop_thread();
+
                if (runnable)
                {
                   if (snd_pcm_drop(pcm) < 0)
@@ -128,13 +162,33 @@ namespace AV
                   if (snd_pcm_prepare(pcm) < 0)
                      runnable = false;
                }
+
+               start_thread();
             }
 
+            void set_audio_callback(ssize_t (*cb)(T*, size_t, void*), void *data = nullptr)
+            {
+               stop_thread();
+               Stream<T>::set_audio_callback(cb, data);
+               start_thread();
+            }
+
+            unsigned rate() const { return fps; }
+            unsigned channels() const { return chan; }
+
+            // What the device settled on, in seconds.
+            double buffer_time() const { return (double)buffer / fps; }
+            double period_time() const { return (double)period / fps; }
+
             float delay()
             {
                if (!runnable)
                   return 0.0;
 
+               // The callback thread owns the PCM while it runs.
+               if (thread_active)
+                  return cached_delay;
+
                snd_pcm_sframes_t delay;
                snd_pcm_delay(pcm, &delay);
 
@@ -143,10 +197,145 @@ namespace AV
 
          private:
 
-            bool runnable;
+            std::atomic<bool> runnable;
             snd_pcm_t *pcm;
             snd_pcm_hw_params_t *params;
             unsigned fps;
+            unsigned chan;
+            snd_pcm_uframes_t period;
+            snd_pcm_uframes_t buffer;
+            bool mmap;
+
+            std::atomic<bool> thread_active;
+            std::atomic<float> cached_delay;
+            std::thread thread;
+
+            void start_thread()
+            {
+               if (runnable && this->callback_active() && !thread_active)
+               {
+                  thread_active = true;
+                  thread = std::thread(&ALSA<T>::callback_thread, this);
+               }
+            }
+
+            void stop_thread()
+            {
+               if (thread_active)
+               {
+                  thread_active = false;
+                  thread.join();
+               }
+            }
+
+            // The device may pick another rate or channel count, the caller converts to whatever fps and chan end up as.
+            int setup(unsigned channels, unsigned samplerate, snd_pcm_access_t access, const DeviceOptions& opts)
+            {
+               int rc;
+               if (
+                     ((rc = snd_pcm_hw_params_any(pcm, params)) < 0) ||
+                     ((rc = snd_pcm_hw_params_set_access(pcm, params, access)) < 0) ||
+                     ((rc = snd_pcm_hw_params_set_channels_near(pcm, params, &channels)) < 0) ||
+                     ((rc = snd_pcm_hw_params_set_format(pcm, params, type_to_format(T()))) < 0) ||
+                     ((rc = snd_pcm_hw_params_set_rate_near(pcm, params, &samplerate, nullptr)) < 0)
+                  )
+                  return rc;
+
+               // Buffer first, so the period gets picked to fit into it.
+               unsigned usecs = opts.buffer_time * 1000000;
+               if (usecs && (rc = snd_pcm_hw_params_set_buffer_time_near(pcm, params, &usecs, nullptr)) < 0)
+                  return rc;
+               usecs = opts.period_time * 1000000;
+               if (usecs && (rc = snd_pcm_hw_params_set_period_time_near(pcm, params, &usecs, nullptr)) < 0)
+                  return rc;
+
+               if ((rc = snd_pcm_hw_params(pcm, params)) < 0)
+                  return rc;
+
+               fps = samplerate;
+               chan = channels;
+               return 0;
+            }
+
+            // Pulls a period at a time, so the device paces the callback.
+            void callback_thread()
+            {
+               std::vector<T> buf(mmap ? 0 : period * chan);
+               while (thread_active)
+               {
+                  int rc = mmap ? mmap_period() : write_period(buf);
+                  if (rc < 0)
+                     break;
+
+                  snd_pcm_sframes_t delay;
+                  if (snd_pcm_delay(pcm, &delay) >= 0)
+                     cached_delay = (float)delay / fps;
+               }
+            }
+
+            // Returns < 0 when the callback or the device gave up.
+            int write_period(std::vector<T>& buf)
+            {
+               ssize_t ret = this->callback(&buf[0], period);
+               if (ret < 0)
+                  return -1;
+
+               std::fill(buf.begin() + ret * chan, buf.end(), 0);
+
+               snd_pcm_sframes_t rc = snd_pcm_writei(pcm, &buf[0], period);
+               return rc < 0 ? recover(rc) : 0;
+            }
+
+            // Same, but the callback writes into the device's buffer itself, which saves a copy.
+            int mmap_period()
+            {
+               snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+               if (avail < 0)
+                  return recover(avail);
+
+               if ((snd_pcm_uframes_t)avail < period)
+               {
+                  // Nothing plays, and so nothing frees up, until the device is started.
+                  if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED)
+                     return recover(snd_pcm_start(pcm));
+                  return recover(snd_pcm_wait(pcm, 100));
+               }
+
+               const snd_pcm_channel_area_t *areas;
+               snd_pcm_uframes_t offset;
+               snd_pcm_uframes_t frames = period;
+               int rc = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames);
+               if (rc < 0)
+                  return recover(rc);
+
+               // Interleaved, so the first channel's area walks whole frames.
+               T *out = reinterpret_cast<T*>(static_cast<uint8_t*>(areas[0].addr) + (areas[0].first + offset * areas[0].step) / 8);
+               ssize_t ret = this->callback(out, frames);
+               if (ret < 0)
+               {
+                  snd_pcm_mmap_commit(pcm, offset, 0);
+                  return -1;
+               }
+               std::fill(out + ret * chan, out + frames * chan, 0);
+
+               snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, frames);
+               if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+                  return recover(committed < 0 ? committed : -EPIPE);
+               return 0;
+            }
+
+            int recover(int rc)
+            {
+               if (rc >= 0)
+                  return 0;
+
+               if (snd_pcm_recover(pcm, rc, 1) < 0)
+               {
+                  runnable = false;
+                  return -1;
+               }
+               return 0;
+            }
 
             // Little-endian only so far!
             snd_pcm_format_t type_to_format(int16_t) { return SND_PCM_FORMAT_S16_LE; }
@@ -0,0 +1,474 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "convert.hpp"
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUDIO_X86 1
+#endif
+
+namespace AV
+{
+   namespace Audio
+   {
+      namespace Internal
+      {
+         static void s16_to_float_c(const int16_t *in, float *out, size_t samples)
+         {
+            for (size_t i = 0; i < samples; i++)
+               out[i] = in[i] * (1.0f / 32768.0f);
+         }
+
+         static void s32_to_float_c(const int32_t *in, float *out, size_t samples)
+         {
+            for (size_t i = 0; i < samples; i++)
+               out[i] = in[i] * (1.0f / 2147483648.0f);
+         }
+
+         static void float_to_s16_c(const float *in, int16_t *out, size_t samples)
+         {
+            for (size_t i = 0; i < samples; i++)
+            {
+               float val = std::min(std::max(in[i] * 32768.0f, -32768.0f), 32767.0f);
+               out[i] = (int16_t)lrintf(val);
+            }
+         }
+
+         static float dot_c(const float *a, const float *b, size_t n)
+         {
+            float sum = 0.0f;
+            for (size_t i = 0; i < n; i++)
+               sum += a[i] * b[i];
+            return sum;
+         }
+
+#ifdef AUDIO_X86
+         __attribute__((target("sse2")))
+         static void s16_to_float_sse2(const int16_t *in, float *out, size_t samples)
+         {
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            size_t i = 0;
+            for (; i + 8 <= samples; i += 8)
+            {
+               __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+               // Put each sample in the top half of a 32-bit lane, then shift it down with its sign.
+               __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(val, val), 16);
+               __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(val, val), 16);
+               _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+               _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+            s16_to_float_c(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("sse2")))
+         static void s32_to_float_sse2(const int32_t *in, float *out, size_t samples)
+         {
+            const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+            size_t i = 0;
+            for (; i + 4 <= samples; i += 4)
+            {
+               __m128i val = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+               _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(val), scale));
+            }
+            s32_to_float_c(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("sse2")))
+         static void float_to_s16_sse2(const float *in, int16_t *out, size_t samples)
+         {
+            // Clamp before converting, cvtps turns anything out of int32 range into INT_MIN.
+            const __m128 scale = _mm_set1_ps(32768.0f);
+            const __m128 low = _mm_set1_ps(-32768.0f);
+            const __m128 high = _mm_set1_ps(32767.0f);
+            size_t i = 0;
+            for (; i + 8 <= samples; i += 8)
+            {
+               __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), low), high);
+               __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), low), high);
+               __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+               _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+            }
+            float_to_s16_c(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("sse2")))
+         static float dot_sse2(const float *a, const float *b, size_t n)
+         {
+            __m128 sum = _mm_setzero_ps();
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+               sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+
+            float lanes[4];
+            _mm_storeu_ps(lanes, sum);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_c(a + i, b + i, n - i);
+         }
+
+         __attribute__((target("avx2")))
+         static void s16_to_float_avx2(const int16_t *in, float *out, size_t samples)
+         {
+            const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+            size_t i = 0;
+            for (; i + 8 <= samples; i += 8)
+            {
+               __m256i val = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+               _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(val), scale));
+            }
+            s16_to_float_c(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("avx2")))
+         static void s32_to_float_avx2(const int32_t *in, float *out, size_t samples)
+         {
+            const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+            size_t i = 0;
+            for (; i + 8 <= samples; i += 8)
+            {
+               __m256i val = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+               _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(val), scale));
+            }
+            s32_to_float_c(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("avx2")))
+         static void float_to_s16_avx2(const float *in, int16_t *out, size_t samples)
+         {
+            const __m256 scale = _mm256_set1_ps(32768.0f);
+            const __m256 low = _mm256_set1_ps(-32768.0f);
+            const __m256 high = _mm256_set1_ps(32767.0f);
+            size_t i = 0;
+            for (; i + 16 <= samples; i += 16)
+            {
+               __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), low), high);
+               __m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), low), high);
+               // packs works within 128-bit lanes, so the middle quarters come out swapped.
+               __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+               packed = _mm256_permute4x64_epi64(packed, 0xd8);
+               _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+            }
+            float_to_s16_sse2(in + i, out + i, samples - i);
+         }
+
+         __attribute__((target("avx2")))
+         static float dot_avx2(const float *a, const float *b, size_t n)
+         {
+            __m256 sum = _mm256_setzero_ps();
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+               sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+
+            __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+            float lanes[4];
+            _mm_storeu_ps(lanes, half);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_c(a + i, b + i, n - i);
+         }
+#endif
+
+         struct Kernels
+         {
+            void (*s16_to_float)(const int16_t*, float*, size_t);
+            void (*s32_to_float)(const int32_t*, float*, size_t);
+            void (*float_to_s16)(const float*, int16_t*, size_t);
+            float (*dot)(const float*, const float*, size_t);
+            const char *name;
+         };
+
+         static Kernels select_kernels()
+         {
+            Kernels kernels = { s16_to_float_c, s32_to_float_c, float_to_s16_c, dot_c, "c" };
+#ifdef AUDIO_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse2"))
+            {
+               Kernels sse2 = { s16_to_float_sse2, s32_to_float_sse2, float_to_s16_sse2, dot_sse2, "sse2" };
+               kernels = sse2;
+            }
+            if (__builtin_cpu_supports("avx2"))
+            {
+               Kernels avx2 = { s16_to_float_avx2, s32_to_float_avx2, float_to_s16_avx2, dot_avx2, "avx2" };
+               kernels = avx2;
+            }
+#endif
+            return kernels;
+         }
+
+         static const Kernels& kernels()
+         {
+            static const Kernels kernels = select_kernels();
+            return kernels;
+         }
+
+         static size_t gcd(size_t a, size_t b)
+         {
+            while (b)
+            {
+               size_t t = a % b;
+               a = b;
+               b = t;
+            }
+            return a;
+         }
+
+         // Odd rate pairs like 44100:44101 would need tens of thousands of phases.
+         // Past this, the nearest phase is close enough.
+         static const size_t max_phases = 1024;
+         static const size_t base_taps = 32;
+         static const size_t max_taps = 256;
+      }
+
+      void s16_to_float(const int16_t *in, float *out, size_t samples) { Internal::kernels().s16_to_float(in, out, samples); }
+      void s32_to_float(const int32_t *in, float *out, size_t samples) { Internal::kernels().s32_to_float(in, out, samples); }
+      void float_to_s16(const float *in, int16_t *out, size_t samples) { Internal::kernels().float_to_s16(in, out, samples); }
+      float dot(const float *a, const float *b, size_t n) { return Internal::kernels().dot(a, b, n); }
+      const char *simd_level() { return Internal::kernels().name; }
+
+      PolyphaseResampler::PolyphaseResampler() : channels(0), up(1), down(1), phases(1), taps(0), pos(0), phase(0)
+      {}
+
+      void PolyphaseResampler::reset(unsigned in_channels, unsigned in_rate, unsigned out_rate)
+      {
+         channels = in_channels;
+         size_t div = Internal::gcd(in_rate, out_rate);
+         up = out_rate / div;
+         down = in_rate / div;
+         phases = std::min(up, Internal::max_phases);
+
+         // Cut off below the lower of the two Nyquist frequencies, leaving some room for the transition band.
+         // The filter has to get longer the lower the cutoff goes.
+         double cutoff = std::min(1.0, (double)up / down);
+         taps = std::min<size_t>((size_t)std::ceil(Internal::base_taps / cutoff / 8.0) * 8, Internal::max_taps);
+         cutoff *= 0.95;
+
+         // Phase p puts the output p / phases of an input frame past the newest input frame used.
+         // Coefficients are stored oldest input first, so a phase is one contiguous dot product.
+         coeffs.assign(phases * taps, 0.0f);
+         for (size_t p = 0; p < phases; p++)
+         {
+            float *phase_coeffs = &coeffs[p * taps];
+            double sum = 0.0;
+            for (size_t k = 0; k < taps; k++)
+            {
+               double dist = (taps - 1 - k) + (double)p / phases;
+               double x = cutoff * (dist - taps / 2.0);
+               double sinc = x == 0.0 ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+               double w = dist / taps;
+               double window = 0.42 - 0.5 * std::cos(2.0 * M_PI * w) + 0.08 * std::cos(4.0 * M_PI * w);
+               phase_coeffs[k] = cutoff * sinc * window;
+               sum += phase_coeffs[k];
+            }
+
+            // Unity gain at DC for every phase, otherwise the ripple between phases is audible.
+            for (size_t k = 0; k < taps; k++)
+               phase_coeffs[k] /= sum;
+         }
+
+         clear();
+      }
+
+      void PolyphaseResampler::clear()
+      {
+         history.assign(channels, std::vector<float>(taps ? taps - 1 : 0, 0.0f));
+         pos = taps ? taps - 1 : 0;
+         phase = 0;
+      }
+
+      size_t PolyphaseResampler::process(const float *in, size_t frames, std::vector<float>& out)
+      {
+         if (channels == 0 || frames == 0)
+            return 0;
+
+         for (unsigned c = 0; c < channels; c++)
+         {
+            auto& hist = history[c];
+            size_t old_size = hist.size();
+            hist.resize(old_size + frames);
+            for (size_t i = 0; i < frames; i++)
+               hist[old_size + i] = in[i * channels + c];
+         }
+
+         size_t avail = history[0].size();
+         out.resize(((frames + 1) * up / down + 2) * channels);
+
+         size_t out_frames = 0;
+         while (pos < avail)
+         {
+            if ((out_frames + 1) * channels > out.size())
+               out.resize(out.size() * 2);
+
+            size_t index = phases == up ? phase : phase * phases / up;
+            const float *phase_coeffs = &coeffs[index * taps];
+            for (unsigned c = 0; c < channels; c++)
+               out[out_frames * channels + c] = dot(&history[c][pos + 1 - taps], phase_coeffs, taps);
+            out_frames++;
+
+            phase += down;
+            pos += phase / up;
+            phase %= up;
+         }
+
+         // Keep what the next output still needs.
+         size_t drop = std::min(pos + 1 - taps, avail);
+         for (auto& hist : history)
+            hist.erase(hist.begin(), hist.begin() + drop);
+         pos -= drop;
+
+         return out_frames;
+      }
+
+      Converter::Converter() : fmt(SampleFormat::S16), in_channels(0), in_rate(0), out_channels(0), out_rate(0)
+      {}
+
+      void Converter::reset(SampleFormat in_fmt, unsigned in_chans, unsigned in_r, unsigned out_chans, unsigned out_r)
+      {
+         fmt = in_fmt;
+         in_channels = in_chans;
+         in_rate = in_r;
+         out_channels = out_chans;
+         out_rate = out_r;
+
+         if (in_rate != out_rate)
+            resampler.reset(out_channels, in_rate, out_rate);
+      }
+
+      void Converter::clear()
+      {
+         if (in_rate != out_rate)
+            resampler.clear();
+      }
+
+      bool Converter::passthrough() const
+      {
+         return fmt == SampleFormat::S16 && in_channels == out_channels && in_rate == out_rate;
+      }
+
+      size_t Converter::bytes_per_sample(SampleFormat fmt)
+      {
+         switch (fmt)
+         {
+            case SampleFormat::U8:
+            case SampleFormat::U8P:
+               return 1;
+            case SampleFormat::S16:
+            case SampleFormat::S16P:
+               return 2;
+            case SampleFormat::S32:
+            case SampleFormat::S32P:
+            case SampleFormat::Float:
+            case SampleFormat::FloatP:
+               return 4;
+            default:
+               return 8;
+         }
+      }
+
+      bool Converter::planar(SampleFormat fmt)
+      {
+         return fmt >= SampleFormat::U8P;
+      }
+
+      void Converter::to_float(const uint8_t *in, SampleFormat packed, float *out, size_t samples)
+      {
+         switch (packed)
+         {
+            case SampleFormat::U8:
+               for (size_t i = 0; i < samples; i++)
+                  out[i] = (in[i] - 128) * (1.0f / 128.0f);
+               break;
+
+            case SampleFormat::S16:
+               s16_to_float(reinterpret_cast<const int16_t*>(in), out, samples);
+               break;
+
+            case SampleFormat::S32:
+               s32_to_float(reinterpret_cast<const int32_t*>(in), out, samples);
+               break;
+
+            case SampleFormat::Float:
+               memcpy(out, in, samples * sizeof(float));
+               break;
+
+            default:
+               for (size_t i = 0; i < samples; i++)
+                  out[i] = reinterpret_cast<const double*>(in)[i];
+               break;
+         }
+      }
+
+      // Mono goes to every output channel. Otherwise channels map one to one, extra ones are dropped or silent.
+      const float* Converter::remix(const float *in, size_t frames)
+      {
+         if (in_channels == out_channels)
+            return in;
+
+         remixed.resize(frames * out_channels);
+         for (size_t i = 0; i < frames; i++)
+         {
+            for (unsigned c = 0; c < out_channels; c++)
+            {
+               float val = 0.0f;
+               if (in_channels == 1)
+                  val = in[i];
+               else if (c < in_channels)
+                  val = in[i * in_channels + c];
+               remixed[i * out_channels + c] = val;
+            }
+         }
+         return &remixed[0];
+      }
+
+      size_t Converter::process(const uint8_t * const *planes, size_t frames, std::vector<int16_t>& out)
+      {
+         if (frames == 0 || in_channels == 0 || out_channels == 0)
+            return 0;
+
+         decoded.resize(frames * in_channels);
+         if (planar(fmt))
+         {
+            // Convert channel by channel, then interleave.
+            SampleFormat packed = static_cast<SampleFormat>(static_cast<int>(fmt) - static_cast<int>(SampleFormat::U8P));
+            plane.resize(frames);
+            for (unsigned c = 0; c < in_channels; c++)
+            {
+               to_float(planes[c], packed, &plane[0], frames);
+               for (size_t i = 0; i < frames; i++)
+                  decoded[i * in_channels + c] = plane[i];
+            }
+         }
+         else
+            to_float(planes[0], fmt, &decoded[0], frames * in_channels);
+
+         const float *mixed = remix(&decoded[0], frames);
+
+         if (in_rate != out_rate)
+         {
+            frames = resampler.process(mixed, frames, resampled);
+            mixed = &resampled[0];
+         }
+
+         out.resize(frames * out_channels);
+         if (frames)
+            float_to_s16(mixed, &out[0], frames * out_channels);
+         return frames;
+      }
+   }
+}
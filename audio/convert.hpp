@@ -0,0 +1,110 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __AUDIO_CONVERT_H
+#define __AUDIO_CONVERT_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace AV
+{
+   namespace Audio
+   {
+      // Mirrors the decoder's sample formats, the P variants have one plane per channel.
+      enum class SampleFormat
+      {
+         U8,
+         S16,
+         S32,
+         Float,
+         Double,
+         U8P,
+         S16P,
+         S32P,
+         FloatP,
+         DoubleP
+      };
+
+      // Bulk kernels, picked once at runtime for the best instruction set the CPU has (AVX2, SSE2 or plain C).
+      // Floats are in [-1, 1], going back to s16 saturates.
+      void s16_to_float(const int16_t *in, float *out, size_t samples);
+      void s32_to_float(const int32_t *in, float *out, size_t samples);
+      void float_to_s16(const float *in, int16_t *out, size_t samples);
+      float dot(const float *a, const float *b, size_t n);
+      const char *simd_level();
+
+      // Converts between any two rates with a windowed-sinc filter, split into one short filter per output phase.
+      // Works on interleaved float, and keeps enough history between calls that buffers join up seamlessly.
+      class PolyphaseResampler
+      {
+         public:
+            PolyphaseResampler();
+            void reset(unsigned channels, unsigned in_rate, unsigned out_rate);
+            // Forgets the history, e.g. after a seek.
+            void clear();
+            // Returns the number of frames written to out.
+            size_t process(const float *in, size_t frames, std::vector<float>& out);
+
+         private:
+            unsigned channels;
+            // Output position advances by down/up input frames per output frame.
+            size_t up, down;
+            size_t phases;
+            size_t taps;
+            std::vector<float> coeffs;
+            // Deinterleaved input, so the filter runs over contiguous samples.
+            std::vector<std::vector<float>> history;
+            // Newest input frame the next output needs, and where between it and the next one it falls.
+            size_t pos;
+            size_t phase;
+      };
+
+      // Gets whatever the decoder hands out into interleaved s16 at the device's channel count and rate.
+      class Converter
+      {
+         public:
+            Converter();
+            void reset(SampleFormat fmt, unsigned in_channels, unsigned in_rate, unsigned out_channels, unsigned out_rate);
+            void clear();
+            // The decoded data can go to the device as it is.
+            bool passthrough() const;
+            // Packed formats only use planes[0]. Returns the number of frames written to out.
+            size_t process(const uint8_t * const *planes, size_t frames, std::vector<int16_t>& out);
+
+            static size_t bytes_per_sample(SampleFormat fmt);
+            static bool planar(SampleFormat fmt);
+
+         private:
+            SampleFormat fmt;
+            unsigned in_channels, in_rate;
+            unsigned out_channels, out_rate;
+            PolyphaseResampler resampler;
+            std::vector<float> decoded;
+            std::vector<float> remixed;
+            std::vector<float> resampled;
+            std::vector<float> plane;
+
+            void to_float(const uint8_t *in, SampleFormat packed, float *out, size_t samples);
+            const float* remix(const float *in, size_t frames);
+      };
+   }
+}
+
+#endif
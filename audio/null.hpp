@@ -25,6 +25,8 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <vector>
 #include "Scheduler.hpp"
 
 namespace AV 
@@ -37,11 +39,18 @@ namespace AV
       {
          public:
             DECL_SMART(Null<T>);
-            Null(unsigned in_chan, unsigned in_rate) : rate(in_rate), chan(in_chan) {}
+            // Without pacing, write() returns right away, as if the device was infinitely fast.
+            Null(unsigned in_chan, unsigned in_rate, bool in_paced = true) : sample_rate(in_rate), chan(in_chan), paced(in_paced), thread_active(false) {}
+
+            ~Null()
+            {
+               stop_thread();
+            }
 
             size_t write(const T*, size_t samples)
             {
-               AV::Scheduler::sync_sleep((float)samples / (rate * chan));
+               if (paced)
+                  AV::Scheduler::sync_sleep((float)samples / (sample_rate * chan));
                return samples;
             }
 
@@ -55,8 +64,67 @@ namespace AV
                return 0; // Return something arbitrary.
             }
 
+            unsigned rate() const { return sample_rate; }
+            unsigned channels() const { return chan; }
+
+            void pause()
+            {
+               stop_thread();
+            }
+
+            void unpause()
+            {
+               start_thread();
+            }
+
+            void set_audio_callback(ssize_t (*cb)(T*, size_t, void*), void *data = nullptr)
+            {
+               stop_thread();
+               Stream<T>::set_audio_callback(cb, data);
+               start_thread();
+            }
+
          private:
-            unsigned rate, chan;
+            unsigned sample_rate, chan;
+            bool paced;
+            std::atomic<bool> thread_active;
+            std::thread thread;
+
+            void start_thread()
+            {
+               if (this->callback_active() && !thread_active)
+               {
+                  thread_active = true;
+                  thread = std::thread(&Null<T>::callback_thread, this);
+               }
+            }
+
+            void stop_thread()
+            {
+               if (thread_active)
+               {
+                  thread_active = false;
+                  thread.join();
+               }
+            }
+
+            // Consumes 10 ms at a time, in real time if paced.
+            void callback_thread()
+            {
+               size_t frames = std::max(sample_rate / 100, 1u);
+               std::vector<T> buf(frames * chan);
+               while (thread_active)
+               {
+                  ssize_t ret = this->callback(&buf[0], frames);
+                  if (ret < 0)
+                     break;
+
+                  if (paced)
+                     AV::Scheduler::sync_sleep((float)frames / sample_rate);
+                  else if (ret == 0)
+                     std::this_thread::sleep_for(std::chrono::milliseconds(1));
+               }
+            }
       };
    }
 }
@@ -0,0 +1,91 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __AUDIO_RESAMPLER_H
+#define __AUDIO_RESAMPLER_H
+
+#include <vector>
+#include <algorithm>
+#include <stddef.h>
+
+namespace AV
+{
+   namespace Audio
+   {
+      // Variable rate linear interpolation on interleaved samples, meant for nudging the playback rate by tiny amounts.
+      // Phase and the last input frame are kept between calls, so consecutive buffers join up without clicks.
+      template <class T>
+      class DriftResampler
+      {
+         public:
+            DriftResampler(unsigned in_channels = 0) : channels(in_channels), ratio(1.0), phase(0.0), last(in_channels) {}
+
+            // Starts over, e.g. after a seek.
+            void reset(unsigned in_channels)
+            {
+               channels = in_channels;
+               phase = 0.0;
+               last.assign(channels, T());
+            }
+
+            // Output frames per input frame. Above 1.0 stretches audio out, below 1.0 speeds it up.
+            void set_ratio(double in_ratio) { ratio = in_ratio; }
+            double get_ratio() const { return ratio; }
+
+            // Resamples frames of interleaved audio into out, and returns the number of frames written.
+            size_t process(const T* in, size_t frames, std::vector<T>& out)
+            {
+               if (frames == 0 || channels == 0)
+                  return 0;
+
+               double step = 1.0 / ratio;
+               out.resize(((size_t)(frames * ratio) + 2) * channels);
+
+               // Position is counted in input frames. -1 is the last frame of the previous buffer.
+               size_t out_frames = 0;
+               double pos = phase;
+               while (pos < frames - 1)
+               {
+                  long index = pos < 0.0 ? -1 : (long)pos;
+                  double frac = pos - index;
+                  const T *a = index < 0 ? &last[0] : in + index * channels;
+                  const T *b = in + (index + 1) * channels;
+
+                  T *dst = &out[out_frames * channels];
+                  for (unsigned c = 0; c < channels; c++)
+                     dst[c] = (T)(a[c] + (b[c] - a[c]) * frac);
+
+                  out_frames++;
+                  pos += step;
+               }
+
+               phase = pos - frames;
+               std::copy(in + (frames - 1) * channels, in + frames * channels, last.begin());
+               return out_frames;
+            }
+
+         private:
+            unsigned channels;
+            double ratio;
+            double phase;
+            std::vector<T> last;
+      };
+   }
+}
+
+#endif
@@ -35,7 +35,7 @@ namespace AV
       {
          public:
             DECL_SMART(RSound<T>);
-            RSound(const std::string& server, int channels, int samplerate, int buffersize = 8092, int latency = 0) : thread_active(false), m_chan(channels)
+            RSound(const std::string& server, int channels, int samplerate, int buffersize = 8092, int latency = 0) : thread_active(false), m_chan(channels), m_rate(samplerate)
             {
                rsd_init(&rd);
                int format = type_to_format(T());
@@ -146,6 +146,9 @@ namespace AV
                }
             }
 
+            unsigned rate() const { return m_rate; }
+            unsigned channels() const { return m_chan; }
+
             float delay()
             {
                if (!runnable)
@@ -161,6 +164,7 @@ namespace AV
             uint8_t *emptybuf;
             volatile bool thread_active;
             unsigned m_chan;
+            unsigned m_rate;
             std::thread thread;
 
             int type_to_format(uint8_t) { return RSD_U8; }
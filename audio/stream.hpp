@@ -45,6 +45,18 @@ namespace AV
             std::string msg;
       };
 
+      // What to ask of the output device. Backends pick out what applies to them.
+      struct DeviceOptions
+      {
+         DeviceOptions() : device("default"), mmap(false), buffer_time(0.0), period_time(0.0) {}
+         std::string device;
+         // Let the callback write straight into the device's buffer when the device allows it.
+         bool mmap;
+         // In seconds, 0 leaves it to the device. We get whatever is closest to what was asked for.
+         double buffer_time;
+         double period_time;
+      };
+
       template<class T>
       class Stream : private General::SmartDefs<Stream<T>>
       {
@@ -74,6 +86,10 @@ namespace AV
             // Returns current audio latency in seconds.
             virtual float delay() { return 0.0; }
 
+            // What the device actually runs at, which isn't necessarily what was asked for.
+            virtual unsigned rate() const = 0;
+            virtual unsigned channels() const = 0;
+
             // By giving this a function pointer different than nullptr, callback interface is activated. write() and write_avail() are no-ops. The callback will call this function sporadically. You can return a number of frames less than desired, but this will usually mean the driver itself will fill the rest with silence. cb_data is userdefined callback data. This can be NULL. After activating callback, by calling this again with NULL for callback argument, callbacks will be disabled and you can use normal, blocking write() and write_avail() again.
             virtual void set_audio_callback(ssize_t (*cb)(T*, size_t frames, void *data), void *cb_data = nullptr)
             {
@@ -19,61 +19,281 @@
 
 #include "FF.hpp"
 #include "AV.hpp"
+#include <algorithm>
 
 using namespace AV;
 using namespace FF;
 
-PacketQueue::PacketQueue() : is_final(false)
+PacketQueue::PacketQueue(size_t capacity) : queue(capacity), serial(0), is_final(false), detached(false), drain_event(nullptr), budget(nullptr), time_base({0, 1}),
+   total_bytes(0), total_duration(0), timed(false), last_ts(AV_NOPTS_VALUE), last_serial(0)
 {}
 
-void PacketQueue::push(Packet&& in)
+void PacketQueue::set_limits(const Limits& in_limits)
 {
-   lock.lock();
-   queue.push(std::move(in));
-   lock.unlock();
-   signal();
+   limits = in_limits;
+}
+
+void PacketQueue::set_time_base(AVRational in_time_base)
+{
+   time_base = in_time_base;
+}
+
+void PacketQueue::set_drain_event(General::ProducerConsumer *event)
+{
+   drain_event = event;
 }
 
-Packet PacketQueue::pull()
+void PacketQueue::set_budget(General::MemoryBudget::Component *in_budget)
 {
-   if (size() == 0)
-      throw std::runtime_error("Tried to pull nothing from queue!\n");
+   budget = in_budget;
+}
+
+// Figures out how much media time a packet holds, in microseconds.
+// Not every demuxer fills in duration, so fall back to the distance between timestamps.
+int64_t PacketQueue::packet_duration(const AVPacket& pkt)
+{
+   if (time_base.num == 0)
+      return 0;
+
+   // Timestamps from before a clear() don't mean anything for the new position.
+   if (last_serial != serial)
+   {
+      last_serial = serial;
+      last_ts = AV_NOPTS_VALUE;
+   }
+
+   int64_t ts = pkt.dts != (int64_t)AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+   int64_t duration = 0;
+
+   if (pkt.duration > 0)
+      duration = pkt.duration;
+   else if (ts != (int64_t)AV_NOPTS_VALUE && last_ts != (int64_t)AV_NOPTS_VALUE && ts > last_ts)
+      duration = ts - last_ts;
+
+   if (ts != (int64_t)AV_NOPTS_VALUE)
+      last_ts = ts;
+
+   return (int64_t)(duration * av_q2d(time_base) * 1000000.0);
+}
+
+bool PacketQueue::push(Packet&& in)
+{
+   if (is_final)
+      return false;
+
+   size_t bytes = in.get().size;
+   int64_t duration = packet_duration(in.get());
+
+   if (!queue.push(Entry(std::move(in), serial, bytes, duration)))
+      return false;
+
+   total_bytes += bytes;
+   total_duration += duration;
+   if (budget)
+      budget->add(bytes);
+   if (duration > 0)
+      timed = true;
 
-   lock.lock();
-   Packet pkt = std::move(queue.front());
-   queue.pop();
-   lock.unlock();
    signal();
-   return pkt;
+   return true;
 }
 
-size_t PacketQueue::size() const
+void PacketQueue::release(const Entry& entry)
 {
-   lock.lock();
-   size_t len = queue.size();
-   lock.unlock();
-   return len;
+   total_bytes -= entry.bytes;
+   total_duration -= entry.duration;
+   if (budget)
+      budget->sub(entry.bytes);
 }
 
-void PacketQueue::clear()
+bool PacketQueue::pull(Packet& out, unsigned *out_serial)
 {
-   lock.lock();
    while (!queue.empty())
+   {
+      auto& entry = queue.front();
+      bool current = entry.serial == serial;
+      if (current)
+      {
+         out = std::move(entry.pkt);
+         if (out_serial)
+            *out_serial = entry.serial;
+      }
+
+      release(entry);
       queue.pop();
-   lock.unlock();
+      signal();
+      if (drain_event)
+         drain_event->signal();
+
+      if (current)
+         return true;
+   }
+
+   return false;
+}
+
+size_t PacketQueue::size() const
+{
+   return queue.size();
+}
+
+bool PacketQueue::full() const
+{
+   return queue.full();
+}
+
+size_t PacketQueue::bytes() const
+{
+   return total_bytes;
+}
+
+double PacketQueue::duration() const
+{
+   return total_duration * 0.000001;
+}
+
+bool PacketQueue::above_high() const
+{
+   return bytes() >= limits.high_bytes || (timed && duration() >= limits.high_duration);
+}
+
+bool PacketQueue::below_low() const
+{
+   return bytes() < limits.low_bytes || (timed && duration() < limits.low_duration);
+}
+
+unsigned PacketQueue::clear()
+{
+   unsigned new_serial = ++serial;
    signal();
+   return new_serial;
+}
+
+unsigned PacketQueue::current_serial() const
+{
+   return serial;
 }
 
 bool PacketQueue::alive() const
 {
-   std::lock_guard<std::mutex> f(lock);
    return queue.size() > 0 || !is_final;
 }
 
 void PacketQueue::finalize()
 {
-   std::lock_guard<std::mutex> f(lock);
    is_final = true;
    signal();
 }
 
+bool PacketQueue::reopen()
+{
+   std::lock_guard<std::mutex> f(final_lock);
+   if (detached)
+      return false;
+
+   is_final = false;
+   return true;
+}
+
+bool PacketQueue::finished()
+{
+   std::lock_guard<std::mutex> f(final_lock);
+   if (is_final && queue.empty())
+      detached = true;
+   return detached;
+}
+
+FrameQueue::FrameQueue(unsigned count) : frames(count), free(count), ready(count), is_final(false), budget(nullptr), total_bytes(0)
+{
+   for (unsigned i = 0; i < count; i++)
+      free.push(std::move(i));
+}
+
+FrameQueue::~FrameQueue()
+{
+   if (budget)
+      budget->sub(total_bytes);
+}
+
+void FrameQueue::set_budget(General::MemoryBudget::Component *in_budget)
+{
+   budget = in_budget;
+}
+
+bool FrameQueue::push(const AVFrame *in, unsigned width, unsigned height, int pix_fmt, double pts, unsigned serial)
+{
+   if (free.empty())
+      return false;
+
+   unsigned index = free.front();
+   free.pop();
+   Frame& frame = frames[index];
+
+   int h_shift = 0, v_shift = 0;
+   avcodec_get_chroma_sub_sample((PixelFormat)pix_fmt, &h_shift, &v_shift);
+
+   // Keep the decoder's pitch so the upload can use it as is.
+   for (unsigned i = 0; i < 3; i++)
+   {
+      unsigned lines = i == 0 ? height : (height + (1 << v_shift) - 1) >> v_shift;
+      size_t size = (size_t)in->linesize[i] * lines;
+
+      if (frame.planes[i].size() < size)
+      {
+         size_t old_size = frame.planes[i].size();
+         frame.planes[i].resize(size);
+         total_bytes += size - old_size;
+         if (budget)
+            budget->add(size - old_size);
+      }
+
+      if (in->data[i])
+         std::copy(in->data[i], in->data[i] + size, &frame.planes[i][0]);
+      frame.linesize[i] = in->linesize[i];
+   }
+
+   frame.width = width;
+   frame.height = height;
+   frame.pts = pts;
+   frame.serial = serial;
+
+   ready.push(std::move(index));
+   signal();
+   return true;
+}
+
+FrameQueue::Frame* FrameQueue::front()
+{
+   if (ready.empty())
+      return nullptr;
+   return &frames[ready.front()];
+}
+
+void FrameQueue::pop()
+{
+   unsigned index = ready.front();
+   ready.pop();
+   free.push(std::move(index));
+   signal();
+}
+
+size_t FrameQueue::size() const
+{
+   return ready.size();
+}
+
+bool FrameQueue::full() const
+{
+   return free.empty();
+}
+
+bool FrameQueue::alive() const
+{
+   return ready.size() > 0 || !is_final;
+}
+
+void FrameQueue::finalize()
+{
+   is_final = true;
+   signal();
+}
@@ -21,11 +21,15 @@
 #define __AV_HPP
 
 #include "General.hpp"
+#include "Ring.hpp"
+#include "Budget.hpp"
+#include "EventLoop.hpp"
 #include "FF.hpp"
 #include "video/display.hpp"
 #include "audio/stream.hpp"
-#include <queue>
 #include <list>
+#include <vector>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
@@ -33,21 +37,86 @@
 
 namespace AV
 {
+   // Queue between the demuxer thread and a single decoder thread. push() is only called by the demuxer, pull() only by the decoder.
+   // clear() can be called from anywhere, it bumps the serial and the decoder throws away whatever was queued before that.
    class PacketQueue : public General::ProducerConsumer
    {
       public:
-         PacketQueue();
-         void push(FF::Packet&& in);
-         FF::Packet pull();
+         // Watermarks for how much a queue should hold. Above either high mark the demuxer stops feeding this queue,
+         // below either low mark the queue is running dry and the demuxer keeps going even if other queues are full.
+         struct Limits
+         {
+            Limits(size_t in_low_bytes = 0, size_t in_high_bytes = 0, double in_low_duration = 0.0, double in_high_duration = 0.0) :
+               low_bytes(in_low_bytes), high_bytes(in_high_bytes), low_duration(in_low_duration), high_duration(in_high_duration) {}
+
+            size_t low_bytes;
+            size_t high_bytes;
+            double low_duration;
+            double high_duration;
+         };
+
+         PacketQueue(size_t capacity = 1024);
+         bool push(FF::Packet&& in);
+         // out_serial is set to the serial the packet was queued with, i.e. how many times the queue was cleared before.
+         bool pull(FF::Packet& out, unsigned *out_serial = nullptr);
          size_t size() const;
-         void clear();
+         bool full() const;
+         // Returns the new serial.
+         unsigned clear();
+         unsigned current_serial() const;
          void finalize();
          bool alive() const;
+         // Undoes finalize(), for seeks after the demuxer hit the end of the file.
+         // Fails if the consumer already saw the end and went away.
+         bool reopen();
+         // Consumer side. True once the queue is finalized and drained, after which reopen() fails.
+         bool finished();
+
+         // Call these before any packets are pushed.
+         void set_limits(const Limits& limits);
+         void set_time_base(AVRational time_base);
+         // Signalled whenever the consumer frees up room in the queue.
+         void set_drain_event(General::ProducerConsumer *event);
+         // Queued payloads are accounted here.
+         void set_budget(General::MemoryBudget::Component *budget);
+
+         size_t bytes() const;
+         double duration() const;
+         bool above_high() const;
+         bool below_low() const;
 
       private:
-         std::queue<FF::Packet> queue;
-         mutable std::mutex lock;
-         bool is_final;
+         struct Entry
+         {
+            Entry(FF::Packet&& in_pkt, unsigned in_serial, size_t in_bytes, int64_t in_duration) :
+               pkt(std::move(in_pkt)), serial(in_serial), bytes(in_bytes), duration(in_duration) {}
+            FF::Packet pkt;
+            unsigned serial;
+            size_t bytes;
+            int64_t duration;
+         };
+
+         General::SPSCRing<Entry> queue;
+         std::atomic<unsigned> serial;
+         std::atomic<bool> is_final;
+         std::mutex final_lock;
+         bool detached;
+         General::ProducerConsumer *drain_event;
+         General::MemoryBudget::Component *budget;
+
+         Limits limits;
+         AVRational time_base;
+         std::atomic<size_t> total_bytes;
+         // Microseconds, so we can keep it atomic.
+         std::atomic<int64_t> total_duration;
+         std::atomic<bool> timed;
+
+         // Producer side only.
+         int64_t last_ts;
+         unsigned last_serial;
+         int64_t packet_duration(const AVPacket& pkt);
+
+         void release(const Entry& entry);
    };
 
    template <class T>
@@ -56,8 +125,8 @@ namespace AV
       public:
          AlignedBuffer(size_t in_size = 0) : m_buf((T*)av_mallocz(in_size * sizeof(T))), m_size(in_size) {}
 
-         AlignedBuffer(const AlignedBuffer& in_buf) { *this = in_buf; }
-         AlignedBuffer(AlignedBuffer&& in_buf) { *this = std::move(in_buf); }
+         AlignedBuffer(const AlignedBuffer& in_buf) : m_buf(nullptr), m_size(0) { *this = in_buf; }
+         AlignedBuffer(AlignedBuffer&& in_buf) : m_buf(nullptr), m_size(0) { *this = std::move(in_buf); }
 
          AlignedBuffer& operator=(const AlignedBuffer& in_buf)
          {
@@ -81,13 +150,57 @@ namespace AV
          const T& operator[](size_t index) const { return m_buf[index]; }
 
          size_t size() const { return m_size; }
-         void resize(size_t in_size) { m_buf = av_realloc(m_buf, in_size * sizeof(T)); m_size = size; }
+         void resize(size_t in_size) { m_buf = (T*)av_realloc(m_buf, in_size * sizeof(T)); m_size = in_size; }
 
       private:
          T *m_buf;
          size_t m_size;
    };
 
+   // Decoded pictures on their way from the video decoder thread to the thread presenting them.
+   // Frames are allocated up front and recycled, so the decoder only ever copies into memory we already have.
+   class FrameQueue : public General::ProducerConsumer
+   {
+      public:
+         struct Frame
+         {
+            AlignedBuffer<uint8_t> planes[3];
+            int linesize[3];
+            unsigned width;
+            unsigned height;
+            double pts;
+            unsigned serial;
+         };
+
+         FrameQueue(unsigned count = 4);
+         void operator=(const FrameQueue&) = delete;
+         FrameQueue(const FrameQueue&) = delete;
+         ~FrameQueue();
+
+         // Decoder side. Copies the picture into the next free frame and queues it. Returns false if every frame is taken.
+         bool push(const AVFrame *frame, unsigned width, unsigned height, int pix_fmt, double pts, unsigned serial);
+         void finalize();
+
+         // Presenter side. front() returns nullptr if nothing is queued, pop() hands the frame back to the decoder.
+         Frame* front();
+         void pop();
+
+         size_t size() const;
+         bool full() const;
+         bool alive() const;
+
+         void set_budget(General::MemoryBudget::Component *budget);
+
+      private:
+         std::vector<Frame> frames;
+         // Frames travel in a circle, indices go to the presenter through ready and come back through free.
+         General::SPSCRing<unsigned> free;
+         General::SPSCRing<unsigned> ready;
+         std::atomic<bool> is_final;
+         General::MemoryBudget::Component *budget;
+         size_t total_bytes;
+   };
+
    class EventHandler : private General::SmartDefs<EventHandler>
    {
       public:
@@ -106,6 +219,8 @@ namespace AV
 
          virtual Event event() = 0;
          virtual void poll() = 0;
+         // Hook up whatever should wake the control thread when there's an event waiting.
+         virtual void attach(General::EventLoop& loop) { (void)loop; }
 
          virtual ~EventHandler() {}
    };
@@ -0,0 +1,137 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Budget.hpp"
+
+namespace General
+{
+   MemoryBudget::Component::Component(MemoryBudget& in_budget, const std::string& name) : budget(in_budget), comp_name(name), used(0), max_used(0)
+   {}
+
+   void MemoryBudget::Component::add(size_t bytes)
+   {
+      update_peak(used += bytes);
+      budget.update(bytes, 0);
+   }
+
+   void MemoryBudget::Component::sub(size_t bytes)
+   {
+      used -= bytes;
+      budget.update(0, bytes);
+   }
+
+   void MemoryBudget::Component::set(size_t bytes)
+   {
+      size_t old = used.exchange(bytes);
+      update_peak(bytes);
+      budget.update(bytes, old);
+   }
+
+   void MemoryBudget::Component::update_peak(size_t now)
+   {
+      size_t old_peak = max_used;
+      while (now > old_peak && !max_used.compare_exchange_weak(old_peak, now));
+   }
+
+   size_t MemoryBudget::Component::usage() const
+   {
+      return used;
+   }
+
+   size_t MemoryBudget::Component::peak() const
+   {
+      return max_used;
+   }
+
+   const std::string& MemoryBudget::Component::name() const
+   {
+      return comp_name;
+   }
+
+   MemoryBudget& MemoryBudget::get()
+   {
+      static MemoryBudget budget;
+      return budget;
+   }
+
+   MemoryBudget::MemoryBudget() : max_bytes(0), total(0), peak_total(0)
+   {}
+
+   MemoryBudget::Component& MemoryBudget::component(const std::string& name)
+   {
+      std::lock_guard<std::mutex> f(lock);
+      for (auto& comp : components)
+      {
+         if (comp.name() == name)
+            return comp;
+      }
+
+      components.emplace_back(*this, name);
+      return components.back();
+   }
+
+   void MemoryBudget::update(size_t added, size_t removed)
+   {
+      // Unsigned wraparound takes care of the delta being negative.
+      size_t delta = added - removed;
+      size_t now = total.fetch_add(delta) + delta;
+
+      size_t old_peak = peak_total;
+      while (now > old_peak && !peak_total.compare_exchange_weak(old_peak, now));
+   }
+
+   void MemoryBudget::set_limit(size_t bytes)
+   {
+      max_bytes = bytes;
+   }
+
+   size_t MemoryBudget::limit() const
+   {
+      return max_bytes;
+   }
+
+   size_t MemoryBudget::usage() const
+   {
+      return total;
+   }
+
+   size_t MemoryBudget::peak() const
+   {
+      return peak_total;
+   }
+
+   bool MemoryBudget::exceeded() const
+   {
+      size_t max = max_bytes;
+      return max && total > max;
+   }
+
+   std::vector<MemoryBudget::Usage> MemoryBudget::report() const
+   {
+      std::lock_guard<std::mutex> f(lock);
+      std::vector<Usage> list;
+      for (auto& comp : components)
+      {
+         Usage entry = { comp.name(), comp.usage(), comp.peak() };
+         list.push_back(entry);
+      }
+      return list;
+   }
+}
+
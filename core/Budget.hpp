@@ -0,0 +1,97 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __BUDGET_HPP
+#define __BUDGET_HPP
+
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <vector>
+#include <string>
+#include <stddef.h>
+
+namespace General
+{
+   // Process wide accounting of memory held in buffers. Anything that sits on a significant amount of buffered data
+   // registers a component here, and the demuxer backs off while the total is above the limit.
+   class MemoryBudget
+   {
+      public:
+         class Component
+         {
+            public:
+               Component(MemoryBudget& budget, const std::string& name);
+
+               void add(size_t bytes);
+               void sub(size_t bytes);
+               // Replaces the whole amount, for components that recompute their usage.
+               void set(size_t bytes);
+
+               size_t usage() const;
+               size_t peak() const;
+               const std::string& name() const;
+
+            private:
+               MemoryBudget& budget;
+               std::string comp_name;
+               std::atomic<size_t> used;
+               std::atomic<size_t> max_used;
+
+               void update_peak(size_t now);
+         };
+
+         struct Usage
+         {
+            std::string name;
+            size_t bytes;
+            size_t peak;
+         };
+
+         static MemoryBudget& get();
+
+         void operator=(const MemoryBudget&) = delete;
+         MemoryBudget(const MemoryBudget&) = delete;
+
+         // Returns the component with this name, registering it the first time.
+         Component& component(const std::string& name);
+
+         // 0 means unlimited.
+         void set_limit(size_t bytes);
+         size_t limit() const;
+         size_t usage() const;
+         size_t peak() const;
+         bool exceeded() const;
+
+         std::vector<Usage> report() const;
+
+      private:
+         MemoryBudget();
+
+         mutable std::mutex lock;
+         std::list<Component> components;
+         std::atomic<size_t> max_bytes;
+         std::atomic<size_t> total;
+         std::atomic<size_t> peak_total;
+
+         void update(size_t added, size_t removed);
+   };
+}
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Clock.hpp"
+#include <chrono>
+#include <cmath>
+
+namespace AV
+{
+   namespace Internal
+   {
+      // Corrections beyond this are real jumps, not jitter.
+      static const double max_smoothed = 0.1;
+      // How much of a small correction is applied each time.
+      static const double smoothing = 0.1;
+      static const double drift_smoothing = 0.05;
+   }
+
+   Clock::Clock() : pts(0.0), time(now()), drift_avg(0.0), paused(false)
+   {}
+
+   double Clock::now()
+   {
+      auto clock = std::chrono::steady_clock::now();
+      std::chrono::nanoseconds time = clock.time_since_epoch();
+      double secs = time.count() * 0.000000001;
+      return secs;
+   }
+
+   double Clock::get_locked(double cur_time) const
+   {
+      if (paused)
+         return pts;
+      return pts + (cur_time - time);
+   }
+
+   void Clock::set(double in_pts)
+   {
+      std::lock_guard<std::mutex> f(lock);
+      double cur_time = now();
+      double diff = in_pts - get_locked(cur_time);
+
+      if (std::fabs(diff) < Internal::max_smoothed)
+      {
+         pts = get_locked(cur_time) + diff * Internal::smoothing;
+
+         // Since only part of each correction is applied, a steady rate error r settles at diff = r * elapsed / smoothing.
+         double elapsed = cur_time - time;
+         if (!paused && elapsed > 0.0)
+            drift_avg += (diff * Internal::smoothing / elapsed - drift_avg) * Internal::drift_smoothing;
+      }
+      else
+      {
+         pts = in_pts;
+         drift_avg = 0.0;
+      }
+      time = cur_time;
+   }
+
+   void Clock::reset(double in_pts)
+   {
+      std::lock_guard<std::mutex> f(lock);
+      pts = in_pts;
+      time = now();
+      drift_avg = 0.0;
+   }
+
+   double Clock::get() const
+   {
+      std::lock_guard<std::mutex> f(lock);
+      return get_locked(now());
+   }
+
+   void Clock::pause(bool in_paused)
+   {
+      std::lock_guard<std::mutex> f(lock);
+      double cur_time = now();
+      pts = get_locked(cur_time);
+      time = cur_time;
+      paused = in_paused;
+   }
+
+   double Clock::drift() const
+   {
+      std::lock_guard<std::mutex> f(lock);
+      return drift_avg;
+   }
+
+   double Clock::age() const
+   {
+      std::lock_guard<std::mutex> f(lock);
+      return now() - time;
+   }
+}
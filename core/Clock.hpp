@@ -0,0 +1,64 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __CLOCK_HPP
+#define __CLOCK_HPP
+
+#include <mutex>
+
+namespace AV
+{
+   // A playback position that gets set every now and then from a stream, and runs along with the system clock in between.
+   // Can be read from any thread.
+   class Clock
+   {
+      public:
+         Clock();
+
+         // Seconds on the steady system clock.
+         static double now();
+
+         // Updates the clock from a stream. Small corrections are smoothed out to hide jitter in the reported position,
+         // anything bigger is taken as it is.
+         void set(double pts);
+         // Jumps straight to pts, e.g. after a seek.
+         void reset(double pts);
+         double get() const;
+
+         // A paused clock stays where it is until unpaused.
+         void pause(bool paused);
+
+         // How fast the stream runs compared to the system clock, in seconds per second, estimated from the corrections
+         // set() has to make. Positive means the stream runs ahead.
+         double drift() const;
+         // Seconds since the clock was last set.
+         double age() const;
+
+      private:
+         mutable std::mutex lock;
+         double pts;
+         double time;
+         double drift_avg;
+         bool paused;
+
+         double get_locked(double time) const;
+   };
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "EventLoop.hpp"
+#include <stdexcept>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+namespace General
+{
+   EventLoop::EventLoop() : epoll_fd(-1), notify_fd(-1), timer_fd(-1), interval(0.0)
+   {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+      if (epoll_fd < 0 || notify_fd < 0 || timer_fd < 0)
+      {
+         if (epoll_fd >= 0)
+            close(epoll_fd);
+         if (notify_fd >= 0)
+            close(notify_fd);
+         if (timer_fd >= 0)
+            close(timer_fd);
+         throw std::runtime_error("Failed to set up event loop\n");
+      }
+
+      watch(notify_fd);
+      watch(timer_fd);
+   }
+
+   EventLoop::~EventLoop()
+   {
+      close(timer_fd);
+      close(notify_fd);
+      close(epoll_fd);
+   }
+
+   void EventLoop::watch(int fd)
+   {
+      struct epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 && errno != EEXIST)
+         throw std::runtime_error("Failed to watch file descriptor\n");
+   }
+
+   void EventLoop::notify()
+   {
+      uint64_t one = 1;
+      ssize_t ret = write(notify_fd, &one, sizeof(one));
+      (void)ret;
+   }
+
+   void EventLoop::set_interval(double secs)
+   {
+      if (secs == interval)
+         return;
+      interval = secs;
+
+      struct itimerspec spec = {};
+      if (secs > 0.0)
+      {
+         spec.it_interval.tv_sec = (time_t)secs;
+         spec.it_interval.tv_nsec = (long)((secs - spec.it_interval.tv_sec) * 1000000000);
+         spec.it_value = spec.it_interval;
+      }
+      timerfd_settime(timer_fd, 0, &spec, nullptr);
+   }
+
+   bool EventLoop::wait(double timeout)
+   {
+      struct epoll_event events[8];
+      int ret = epoll_wait(epoll_fd, events, 8, timeout < 0.0 ? -1 : (int)(timeout * 1000));
+      if (ret <= 0)
+         return false;
+
+      // Our own fds only have to be drained, the rest is read by their owners.
+      for (int i = 0; i < ret; i++)
+      {
+         if (events[i].data.fd == notify_fd || events[i].data.fd == timer_fd)
+         {
+            uint64_t count;
+            ssize_t rc = read(events[i].data.fd, &count, sizeof(count));
+            (void)rc;
+         }
+      }
+
+      return true;
+   }
+}
@@ -0,0 +1,53 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __EVENT_LOOP_HPP
+#define __EVENT_LOOP_HPP
+
+namespace General
+{
+   // Lets the control thread block until there's actually something to do: input on a watched fd,
+   // a notify() from another thread, or a tick of the interval timer.
+   class EventLoop
+   {
+      public:
+         EventLoop();
+         ~EventLoop();
+         void operator=(const EventLoop&) = delete;
+         EventLoop(const EventLoop&) = delete;
+
+         // Wakes up wait() whenever fd is readable. Reading the data is up to whoever owns fd.
+         void watch(int fd);
+         // Can be called from any thread.
+         void notify();
+         // Wakes up wait() periodically. 0 turns the timer off.
+         void set_interval(double secs);
+
+         // Returns false if nothing happened before the timeout. A negative timeout waits forever.
+         bool wait(double timeout = -1.0);
+
+      private:
+         int epoll_fd;
+         int notify_fd;
+         int timer_fd;
+         double interval;
+   };
+}
+
+#endif
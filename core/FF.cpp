@@ -18,44 +18,18 @@
 
 
 #include "FF.hpp"
+#include "PacketPool.hpp"
+#include "Input.hpp"
+#include "Index.hpp"
 #include <stdexcept>
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <sys/stat.h>
 
 namespace FF
 {
 
-   namespace Internal
-   {
-      static uint64_t g_video_pkt_pts = AV_NOPTS_VALUE;
-
-      // Custom functions for packets. Make sure that we get the correct PTS values from the packets when needed.
-      extern "C" {
-         static int get_buffer(AVCodecContext *c, AVFrame *pic);
-         static void release_buffer(AVCodecContext *c, AVFrame *pic);
-      }
-
-      static int get_buffer(AVCodecContext *c, AVFrame *pic)
-      {
-         int ret = avcodec_default_get_buffer(c, pic);
-         uint64_t *pts = (uint64_t*)av_malloc(sizeof(uint64_t));
-         *pts = g_video_pkt_pts;
-         pic->opaque = pts;
-         return ret;
-      }
-
-      static void release_buffer(AVCodecContext *c, AVFrame *pic)
-      {
-         if (pic) av_freep(&pic->opaque);
-         avcodec_default_release_buffer(c, pic);
-      }
-   }
-
-   void set_global_pts(uint64_t pts)
-   {
-      Internal::g_video_pkt_pts = pts;
-   }
-
    // FFmpeg global init. This is called on every instance of MediaFile.
    FFMPEG::FFMPEG()
    {
@@ -70,16 +44,17 @@ namespace FF
 
    Packet::Packet() : pkt(nullptr)
    {
-      pkt = (AVPacket*)av_mallocz(sizeof(AVPacket));
+      pkt = PacketPool::get().alloc_shell();
    }
 
    // Move semantic. We can never allow two copies of the same Packet out there in the wild.
    Packet& Packet::operator=(Packet&& in_pkt)
    {
-      if (pkt && pkt->data)
-         av_free_packet(pkt);
       if (pkt)
-         av_freep(&pkt);
+      {
+         av_free_packet(pkt);
+         PacketPool::get().free_shell(pkt);
+      }
 
       pkt = in_pkt.pkt;
       in_pkt.pkt = nullptr;
@@ -104,24 +79,74 @@ namespace FF
       if (pkt)
       {
          av_free_packet(pkt);
-         av_freep(&pkt);
+         PacketPool::get().free_shell(pkt);
       }
    }
 
-   MediaFile::MediaFile(const char *path) : vcodec(nullptr), acodec(nullptr), actx(nullptr), vctx(nullptr), sctx(nullptr), fctx(nullptr), vid_stream(-1), aud_stream(-1), sub_stream(-1)
+   MediaFile::MediaFile(const char *path, const Options& opts) : vcodec(nullptr), acodec(nullptr), actx(nullptr), vctx(nullptr), sctx(nullptr), fctx(nullptr), vid_stream(-1), aud_stream(-1), sub_stream(-1)
    {
       if (path == nullptr)
          throw std::runtime_error("Got null-path\n");
 
+      // Only plain files go through our own I/O, anything else uses the protocols in libavformat.
+      struct stat st;
+      bool local = stat(path, &st) == 0 && S_ISREG(st.st_mode);
+      if ((opts.mmap || opts.prefetch) && local)
+      {
+         if (opts.mmap)
+         {
+            try
+            {
+               input = MappedInput::shared(path);
+            }
+            catch (std::exception& e)
+            {
+               std::cerr << e.what() << std::endl;
+            }
+         }
+
+         if (!input && opts.prefetch)
+            input = PrefetchInput::shared(path, opts.prefetch_size);
+      }
+
+      if (input)
+      {
+         fctx = avformat_alloc_context();
+         if (!fctx)
+            throw std::runtime_error("Failed to allocate format context\n");
+
+         fctx->pb = input->context();
+         fctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+      }
+
+      // On failure, fctx is freed for us.
       if (avformat_open_input(&fctx, path, nullptr, nullptr) != 0)
          throw std::runtime_error("Failed to open file\n");
 
       if (avformat_find_stream_info(fctx, nullptr) < 0)
          throw std::runtime_error("Failed to get stream information\n");
 
-      resolve_codecs();
+      resolve_codecs(opts.threads);
       set_media_info();
 
+      // Remember which streams came with an index from the container. The generic index in libavformat fills up as we go,
+      // so looking at it later doesn't tell us much.
+      for (unsigned i = 0; i < fctx->nb_streams; i++)
+         container_indexed.push_back(fctx->streams[i]->nb_index_entries > 0);
+
+      // Containers like MKV and MP4 already tell us where the keyframes are, so only build (and cache) our own index
+      // when one of the streams we play lacks it.
+      bool need_index = false;
+      if (vid_stream >= 0 && !container_indexed[vid_stream])
+         need_index = true;
+      if (aud_stream >= 0 && !container_indexed[aud_stream])
+         need_index = true;
+      if (fctx->iformat->flags & AVFMT_NO_BYTE_SEEK)
+         need_index = false;
+
+      if (opts.keyframe_index && local && need_index)
+         kf_index = std::unique_ptr<KeyframeIndex>(new KeyframeIndex(path));
+
       // Debug
       //dump_format(fctx, 0, path, false);
    }
@@ -138,7 +163,7 @@ namespace FF
          av_close_input_file(fctx);
    }
 
-   void MediaFile::resolve_codecs()
+   void MediaFile::resolve_codecs(unsigned threads)
    {
       // Find first video stream.
       for (unsigned i = 0; i < fctx->nb_streams; i++)
@@ -182,7 +207,16 @@ namespace FF
          vctx = fctx->streams[vid_stream]->codec;
          vcodec = avcodec_find_decoder(vctx->codec_id);
          if (vcodec)
+         {
+            // libavcodec won't go beyond 16 threads, and each frame thread adds a frame of latency anyway.
+            if (threads == 0)
+               threads = std::min(std::max(std::thread::hardware_concurrency(), 1u), 16u);
+
+            // Codecs pick whichever of these they support. Frame threading is preferred if both are there.
+            vctx->thread_count = threads;
+            vctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
             avcodec_open2(vctx, vcodec, nullptr);
+         }
       }
 
       if (aud_stream >= 0)
@@ -254,9 +288,6 @@ namespace FF
          vid_info.active = true;
          vid_info.time_base = fctx->streams[vid_stream]->time_base;
          vid_info.ctx = vctx;
-
-         vctx->get_buffer = Internal::get_buffer;
-         vctx->release_buffer = Internal::release_buffer;
       }
       else
          vid_info.active = false;
@@ -270,9 +301,9 @@ namespace FF
          sub_info.active = false;
    }
 
-   void MediaFile::seek(double video_pts, double audio_pts, double rel, SeekTarget target)
+   void MediaFile::seek(double video_pts, double audio_pts, double rel, SeekTarget target, bool at_or_before)
    {
-      int flags = (rel < 0.0) ? AVSEEK_FLAG_BACKWARD : 0;
+      int flags = (rel < 0.0 || at_or_before) ? AVSEEK_FLAG_BACKWARD : 0;
 
       double seek_to = 0.0;
       int stream = -1;
@@ -289,16 +320,43 @@ namespace FF
             seek_to = 0.0;
       }
 
-      if (av_seek_frame(fctx, stream, seek_to, flags) < 0)
+      if (!index_seek(stream, seek_to) && av_seek_frame(fctx, stream, seek_to, flags) < 0)
          throw std::runtime_error("av_seek_frame() failed");
+   }
 
-      // We need to flush our buffers after seeking.
-      if (acodec)
-         avcodec_flush_buffers(actx);
-      if (vcodec)
-         avcodec_flush_buffers(vctx);
-      if (scodec)
-         avcodec_flush_buffers(sctx);
+   void MediaFile::index_packet(const AVPacket& pkt)
+   {
+      int stream = pkt.stream_index;
+      if ((stream != vid_stream && stream != aud_stream) || container_indexed[stream])
+         return;
+      if (!(pkt.flags & AV_PKT_FLAG_KEY) || pkt.pos < 0)
+         return;
+
+      int64_t ts = pkt.pts != (int64_t)AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+      if (ts == (int64_t)AV_NOPTS_VALUE)
+         return;
+
+      // Every audio packet is a keyframe, so keep the index down to a couple of entries per second.
+      int64_t min_distance = 0;
+      if (stream == aud_stream)
+         min_distance = 0.5 / av_q2d(fctx->streams[stream]->time_base);
+      kf_index->add(stream, ts, pkt.pos, min_distance);
+   }
+
+   bool MediaFile::index_seek(int stream, int64_t pts)
+   {
+      if (!kf_index || stream < 0 || container_indexed[stream])
+         return false;
+      if (fctx->iformat->flags & AVFMT_NO_BYTE_SEEK)
+         return false;
+
+      // If the closest known keyframe is too far away, we probably just haven't seen the ones in between.
+      int64_t max_distance = 10.0 / av_q2d(fctx->streams[stream]->time_base);
+      int64_t pos;
+      if (!kf_index->lookup(stream, std::max<int64_t>(pts, 0), max_distance, pos))
+         return false;
+
+      return av_seek_frame(fctx, stream, pos, AVSEEK_FLAG_BYTE) >= 0;
    }
 
    const MediaFile::audio_info& MediaFile::audio() const
@@ -323,7 +381,12 @@ namespace FF
          return Packet::Type::Error;
 
       // Makes sure that packet has it's own allocated space. So we can put it in a queue safely.
-      av_dup_packet(&pkt.get());
+      // Payloads are recycled through the packet pool rather than the heap.
+      if (PacketPool::get().dup(pkt.get()) < 0)
+         return Packet::Type::Error;
+
+      if (kf_index)
+         index_packet(pkt.get());
 
       Packet::Type type = Packet::Type::None;
 
@@ -63,8 +63,6 @@ extern "C" {
 
 namespace FF
 {
-   void set_global_pts(uint64_t);
-
    enum class SeekTarget
    {
       Video,
@@ -106,11 +104,30 @@ namespace FF
          ~FFMPEG();
    };
 
+   class Input;
+   class KeyframeIndex;
+
    class MediaFile : public FFMPEG, private General::SmartDefs<MediaFile>
    {
       public:
          DECL_SMART(MediaFile);
-         MediaFile(const char *path);
+
+         struct Options
+         {
+            Options() : prefetch(true), prefetch_size(16 * 1024 * 1024), mmap(false), keyframe_index(true), threads(0) {}
+
+            // Read local files ahead of the demuxer in a separate thread.
+            bool prefetch;
+            size_t prefetch_size;
+            // Map local files into memory instead. Takes precedence over prefetching.
+            bool mmap;
+            // Keep our own keyframe index for containers without one, cached between runs.
+            bool keyframe_index;
+            // Video decoding threads, 0 means one per core.
+            unsigned threads;
+         };
+
+         MediaFile(const char *path, const Options& opts = Options());
          MediaFile(MediaFile&&);
          MediaFile& operator=(MediaFile&&);
          void operator=(const MediaFile&) = delete;
@@ -149,7 +166,9 @@ namespace FF
          const subtitle_info& sub() const;
 
          Packet::Type packet(Packet&);
-         void seek(double video_pts, double audio_pts, double relative, SeekTarget target = SeekTarget::Default);
+         // Only moves the demuxer. Decoders have to be flushed by whoever is running them.
+         // With at_or_before, forward seeks also land on a keyframe before the target, so it can be decoded up to exactly.
+         void seek(double video_pts, double audio_pts, double relative, SeekTarget target = SeekTarget::Default, bool at_or_before = false);
 
       private:
          AVCodec *vcodec;
@@ -159,6 +178,9 @@ namespace FF
          AVCodecContext *vctx;
          AVCodecContext *sctx;
          AVFormatContext *fctx;
+         std::shared_ptr<Input> input;
+         std::unique_ptr<KeyframeIndex> kf_index;
+         std::vector<bool> container_indexed;
          audio_info aud_info;
          video_info vid_info;
          subtitle_info sub_info;
@@ -167,8 +189,10 @@ namespace FF
          int aud_stream;
          int sub_stream;
 
-         void resolve_codecs();
+         void resolve_codecs(unsigned threads);
          void set_media_info();
+         void index_packet(const AVPacket& pkt);
+         bool index_seek(int stream, int64_t pts);
    };
 }
 
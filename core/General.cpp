@@ -1,30 +1,43 @@
 #include "General.hpp"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
 
 using namespace General;
 
-ProducerConsumer::ProducerConsumer() : can_sleep(true)
+ProducerConsumer::ProducerConsumer() : sequence(0), waiters(0)
 {}
 
 ProducerConsumer::~ProducerConsumer()
 {
-   cond.notify_all();
+   signal();
 }
 
-void ProducerConsumer::wait()
+void ProducerConsumer::wait(int seq, double timeout)
 {
-   std::unique_lock<std::mutex> l(cond_lock);
-   if (can_sleep)
+   struct timespec ts;
+   if (timeout >= 0.0)
    {
-      can_sleep = false;
-      cond.notify_one();
-      cond.wait(l);
-      can_sleep = true;
+      ts.tv_sec = (time_t)timeout;
+      ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1000000000);
    }
-   else
-      cond.notify_one();
+
+   // Returns right away if someone signalled since seq was read.
+   syscall(SYS_futex, reinterpret_cast<int*>(&sequence), FUTEX_WAIT_PRIVATE, seq, timeout >= 0.0 ? &ts : nullptr, nullptr, 0);
+}
+
+double ProducerConsumer::now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 0.000000001;
 }
 
 void ProducerConsumer::signal()
 {
-   cond.notify_one();
+   sequence++;
+   if (waiters > 0)
+      syscall(SYS_futex, reinterpret_cast<int*>(&sequence), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
 }
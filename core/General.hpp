@@ -23,6 +23,7 @@
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <string>
 #include <sstream>
 
@@ -92,6 +93,8 @@ namespace General
    template<class T>
    unsigned RefCounted<T>::cnt = 0;
 
+   // Futex backed wakeup. Waiters check their condition against a sequence number taken before the check,
+   // so a signal() racing with the check can never get lost.
    class ProducerConsumer
    {
       public:
@@ -99,11 +102,46 @@ namespace General
          ~ProducerConsumer();
 
          void signal();
-         void wait();
+
+         template <class F>
+         void wait_until(F pred)
+         {
+            waiters++;
+            for (;;)
+            {
+               int seq = sequence;
+               if (pred())
+                  break;
+               wait(seq);
+            }
+            waiters--;
+         }
+
+         // Like wait_until(), but gives up after timeout seconds. Returns the last result of pred.
+         template <class F>
+         bool wait_for(F pred, double timeout)
+         {
+            double deadline = now() + timeout;
+            bool res;
+            waiters++;
+            for (;;)
+            {
+               int seq = sequence;
+               res = pred();
+               double left = deadline - now();
+               if (res || left <= 0.0)
+                  break;
+               wait(seq, left);
+            }
+            waiters--;
+            return res;
+         }
+
       private:
-         bool can_sleep;
-         std::condition_variable cond;
-         std::mutex cond_lock;
+         std::atomic<int> sequence;
+         std::atomic<int> waiters;
+         void wait(int seq, double timeout = -1.0);
+         static double now();
    };
 
    template <class T>
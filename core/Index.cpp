@@ -0,0 +1,244 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Index.hpp"
+#include "General.hpp"
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdlib.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <time.h>
+#include <utime.h>
+#include <dirent.h>
+#include <unistd.h>
+
+namespace FF
+{
+   namespace Internal
+   {
+      static const char index_magic[8] = { 'S', 'L', 'I', 'M', 'I', 'D', 'X', '1' };
+      static const time_t max_age = 30 * 24 * 60 * 60;
+
+      template <class T>
+      static void write_pod(std::ostream& out, const T& t)
+      {
+         out.write(reinterpret_cast<const char*>(&t), sizeof(T));
+      }
+
+      template <class T>
+      static bool read_pod(std::istream& in, T& t)
+      {
+         return static_cast<bool>(in.read(reinterpret_cast<char*>(&t), sizeof(T)));
+      }
+   }
+
+   std::string KeyframeIndex::cache_dir()
+   {
+      const char *xdg = getenv("XDG_CACHE_HOME");
+      const char *home = getenv("HOME");
+
+      std::string dir;
+      if (xdg && *xdg)
+         dir = xdg;
+      else if (home && *home)
+         dir = General::join(home, "/.cache");
+      else
+         return "";
+
+      mkdir(dir.c_str(), 0755);
+      dir += "/slimplayer";
+      mkdir(dir.c_str(), 0755);
+      return dir;
+   }
+
+   void KeyframeIndex::prune(const std::string& dir)
+   {
+      DIR *dp = opendir(dir.c_str());
+      if (!dp)
+         return;
+
+      time_t now = time(nullptr);
+      while (struct dirent *ent = readdir(dp))
+      {
+         std::string name = ent->d_name;
+         if (name.size() < 4 || (name.compare(name.size() - 4, 4, ".idx") != 0 && name.compare(name.size() - 4, 4, ".tmp") != 0))
+            continue;
+
+         std::string file = General::join(dir, "/", name);
+         struct stat st;
+         if (stat(file.c_str(), &st) == 0 && now - st.st_mtime > Internal::max_age)
+            unlink(file.c_str());
+      }
+
+      closedir(dp);
+   }
+
+   KeyframeIndex::KeyframeIndex(const std::string& path) : file_size(0), file_mtime(0), dirty(false)
+   {
+      struct stat st;
+      char real[PATH_MAX];
+      if (stat(path.c_str(), &st) < 0 || !realpath(path.c_str(), real))
+         return;
+
+      file_size = st.st_size;
+      file_mtime = st.st_mtime;
+
+      std::string dir = cache_dir();
+      if (dir.empty())
+         return;
+
+      std::ostringstream name;
+      name << dir << "/" << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(real) << ".idx";
+      cache_path = name.str();
+
+      load();
+   }
+
+   KeyframeIndex::~KeyframeIndex()
+   {
+      if (dirty)
+         save();
+   }
+
+   void KeyframeIndex::add(int stream, int64_t pts, int64_t pos, int64_t min_distance)
+   {
+      auto& list = streams[stream];
+      auto itr = std::lower_bound(list.begin(), list.end(), pts, [](const Entry& entry, int64_t val) { return entry.pts < val; });
+
+      if (itr != list.end() && itr->pts - pts <= min_distance)
+         return;
+      if (itr != list.begin() && pts - (itr - 1)->pts <= min_distance)
+         return;
+
+      Entry entry = { pts, pos };
+      list.insert(itr, entry);
+      dirty = true;
+   }
+
+   bool KeyframeIndex::lookup(int stream, int64_t pts, int64_t max_distance, int64_t& pos) const
+   {
+      auto stream_itr = streams.find(stream);
+      if (stream_itr == streams.end())
+         return false;
+
+      auto& list = stream_itr->second;
+      auto itr = std::upper_bound(list.begin(), list.end(), pts, [](int64_t val, const Entry& entry) { return val < entry.pts; });
+      if (itr == list.begin())
+         return false;
+
+      --itr;
+      if (pts - itr->pts > max_distance)
+         return false;
+
+      pos = itr->pos;
+      return true;
+   }
+
+   bool KeyframeIndex::load()
+   {
+      std::ifstream in(cache_path.c_str(), std::ios::binary);
+      if (!in)
+         return false;
+
+      // Counts in a damaged file can't be trusted, so check them against what is actually there.
+      in.seekg(0, std::ios::end);
+      int64_t cache_size = in.tellg();
+      in.seekg(0, std::ios::beg);
+      if (cache_size < 0)
+         return false;
+
+      char magic[8];
+      int64_t size, mtime;
+      uint32_t num_streams;
+      if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), Internal::index_magic))
+         return false;
+      if (!Internal::read_pod(in, size) || !Internal::read_pod(in, mtime) || size != file_size || mtime != file_mtime)
+         return false;
+      if (!Internal::read_pod(in, num_streams))
+         return false;
+
+      std::map<int, std::vector<Entry>> loaded;
+      for (uint32_t i = 0; i < num_streams; i++)
+      {
+         int32_t stream;
+         uint64_t count;
+         if (!Internal::read_pod(in, stream) || !Internal::read_pod(in, count))
+            return false;
+         if (count > (uint64_t)(cache_size - (int64_t)in.tellg()) / sizeof(Entry))
+            return false;
+
+         auto& list = loaded[stream];
+         list.resize(count);
+         if (count && !in.read(reinterpret_cast<char*>(&list[0]), count * sizeof(Entry)))
+            return false;
+
+         if (!std::is_sorted(list.begin(), list.end(), [](const Entry& a, const Entry& b) { return a.pts < b.pts; }))
+            return false;
+      }
+
+      streams.swap(loaded);
+      // Bump the modification time so indexes that are still in use don't get pruned.
+      utime(cache_path.c_str(), nullptr);
+      return true;
+   }
+
+   bool KeyframeIndex::save()
+   {
+      if (cache_path.empty())
+         return false;
+
+      // Write to the side and rename, so a crash or another instance never leaves a half written index around.
+      // Another player could be indexing the same file right now, don't share a temporary with it.
+      std::string tmp_path = General::join(cache_path, ".", getpid(), ".tmp");
+      {
+         std::ofstream out(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+         if (!out)
+            return false;
+
+         out.write(Internal::index_magic, sizeof(Internal::index_magic));
+         Internal::write_pod(out, file_size);
+         Internal::write_pod(out, file_mtime);
+         Internal::write_pod(out, (uint32_t)streams.size());
+
+         for (auto& stream : streams)
+         {
+            Internal::write_pod(out, (int32_t)stream.first);
+            Internal::write_pod(out, (uint64_t)stream.second.size());
+            if (!stream.second.empty())
+               out.write(reinterpret_cast<const char*>(&stream.second[0]), stream.second.size() * sizeof(Entry));
+         }
+
+         if (!out)
+            return false;
+      }
+
+      if (rename(tmp_path.c_str(), cache_path.c_str()) < 0)
+         return false;
+
+      dirty = false;
+      prune(cache_path.substr(0, cache_path.rfind('/')));
+      return true;
+   }
+}
+
@@ -0,0 +1,72 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __INDEX_HPP
+#define __INDEX_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+
+namespace FF
+{
+   // Maps keyframe timestamps to byte offsets for containers that don't have an index of their own.
+   // Filled in as packets are demuxed and persisted in a cache file, so the next time the file is opened seeks are a binary search.
+   // Cache files live in $XDG_CACHE_HOME/slimplayer (~/.cache/slimplayer), one per media file. Ones that haven't been
+   // used for a month are removed whenever a new index is written.
+   class KeyframeIndex
+   {
+      public:
+         // The cache is tied to the file's size and modification time, and thrown away if either changes.
+         KeyframeIndex(const std::string& path);
+         ~KeyframeIndex();
+
+         void operator=(const KeyframeIndex&) = delete;
+         KeyframeIndex(const KeyframeIndex&) = delete;
+
+         // Entries closer than min_distance to an existing one are skipped, so dense streams don't blow up the index.
+         void add(int stream, int64_t pts, int64_t pos, int64_t min_distance = 0);
+
+         // Finds the last keyframe at or before pts. Fails if there is none within max_distance,
+         // since there might be keyframes in between we haven't seen yet.
+         bool lookup(int stream, int64_t pts, int64_t max_distance, int64_t& pos) const;
+
+         bool save();
+
+      private:
+         struct Entry
+         {
+            int64_t pts;
+            int64_t pos;
+         };
+
+         std::map<int, std::vector<Entry>> streams;
+         std::string cache_path;
+         int64_t file_size;
+         int64_t file_mtime;
+         bool dirty;
+
+         bool load();
+         static std::string cache_dir();
+         static void prune(const std::string& dir);
+   };
+}
+
+#endif
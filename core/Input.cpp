@@ -0,0 +1,325 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Input.hpp"
+#include <stdexcept>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace FF
+{
+   namespace Internal
+   {
+      static const int avio_buffer_size = 32 * 1024;
+      static const size_t prefetch_chunk = 1024 * 1024;
+      // How far beyond the ring buffer we ask the kernel to start reading.
+      static const off_t readahead_hint = 4 * 1024 * 1024;
+      // Mapped reads are just a memcpy(), so let anything but the smallest reads skip the AVIOContext buffer.
+      static const int mapped_buffer_size = 4 * 1024;
+   }
+
+   Input::Input(int in_buffer_size) : ctx(nullptr), buffer_size(in_buffer_size)
+   {}
+
+   Input::~Input()
+   {
+      if (ctx)
+      {
+         av_free(ctx->buffer);
+         av_free(ctx);
+      }
+   }
+
+   int Input::read_cb(void *data, uint8_t *buf, int size)
+   {
+      return reinterpret_cast<Input*>(data)->read(buf, size);
+   }
+
+   int64_t Input::seek_cb(void *data, int64_t offset, int whence)
+   {
+      return reinterpret_cast<Input*>(data)->seek(offset, whence);
+   }
+
+   AVIOContext* Input::context()
+   {
+      if (!ctx)
+      {
+         uint8_t *buf = (uint8_t*)av_malloc(buffer_size);
+         if (!buf)
+            throw std::runtime_error("Failed to allocate I/O buffer\n");
+
+         ctx = avio_alloc_context(buf, buffer_size, 0, this, &Input::read_cb, nullptr, &Input::seek_cb);
+         if (!ctx)
+         {
+            av_free(buf);
+            throw std::runtime_error("Failed to allocate I/O context\n");
+         }
+      }
+
+      return ctx;
+   }
+
+   PrefetchInput::PrefetchInput(const std::string& path, size_t buffer_size) : Input(Internal::avio_buffer_size),
+      fd(-1), file_size(0), ring(std::max(buffer_size, Internal::prefetch_chunk)), head(0), fill(0), back(0), pos(0), eof(false), error(false), generation(0), thread_active(true)
+   {
+      fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+         throw std::runtime_error(General::join("Failed to open ", path, "\n"));
+
+      struct stat st;
+      if (fstat(fd, &st) < 0)
+      {
+         close(fd);
+         throw std::runtime_error(General::join("Failed to stat ", path, "\n"));
+      }
+      file_size = st.st_size;
+
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      posix_fadvise(fd, 0, std::min<off_t>(buffer_size, file_size), POSIX_FADV_WILLNEED);
+
+      thread = std::thread(&PrefetchInput::prefetch_thread, this);
+   }
+
+   PrefetchInput::~PrefetchInput()
+   {
+      lock.lock();
+      thread_active = false;
+      cond.notify_all();
+      lock.unlock();
+
+      thread.join();
+      close(fd);
+   }
+
+   int PrefetchInput::read(uint8_t *buf, int size)
+   {
+      std::unique_lock<std::mutex> l(lock);
+      while (fill == 0 && !eof && !error)
+         cond.wait(l);
+
+      if (fill == 0)
+         return error ? -1 : 0;
+
+      size_t to_read = std::min<size_t>(size, fill);
+      size_t first = std::min(to_read, ring.size() - head);
+      memcpy(buf, &ring[head], first);
+      memcpy(buf + first, &ring[0], to_read - first);
+
+      head = (head + to_read) % ring.size();
+      fill -= to_read;
+      back = std::min(back + to_read, ring.size() - fill);
+      pos += to_read;
+
+      cond.notify_all();
+      return to_read;
+   }
+
+   int64_t PrefetchInput::seek(int64_t offset, int whence)
+   {
+      std::lock_guard<std::mutex> f(lock);
+
+      int64_t target;
+      switch (whence)
+      {
+         case AVSEEK_SIZE:
+            return file_size;
+
+         case SEEK_SET:
+            target = offset;
+            break;
+
+         case SEEK_CUR:
+            target = pos + offset;
+            break;
+
+         case SEEK_END:
+            target = file_size + offset;
+            break;
+
+         default:
+            return -1;
+      }
+
+      if (target < 0)
+         return -1;
+
+      // Stay within what we have buffered if we can.
+      if (target >= pos - (int64_t)back && target <= pos + (int64_t)fill)
+      {
+         int64_t delta = target - pos;
+         head = (head + ring.size() + delta) % ring.size();
+         fill -= delta;
+         back += delta;
+         pos = target;
+         return pos;
+      }
+
+      // Throw away everything and start over at the new position.
+      generation++;
+      head = 0;
+      fill = 0;
+      back = 0;
+      pos = target;
+      eof = false;
+      error = false;
+      posix_fadvise(fd, target, Internal::readahead_hint, POSIX_FADV_WILLNEED);
+
+      cond.notify_all();
+      return pos;
+   }
+
+   void PrefetchInput::prefetch_thread()
+   {
+      std::unique_lock<std::mutex> l(lock);
+
+      while (thread_active)
+      {
+         if (eof || error || fill == ring.size())
+         {
+            cond.wait(l);
+            continue;
+         }
+
+         size_t tail = (head + fill) % ring.size();
+         size_t chunk = std::min(std::min(ring.size() - fill, ring.size() - tail), Internal::prefetch_chunk);
+         int64_t read_pos = pos + fill;
+         unsigned gen = generation;
+
+         // We're about to overwrite this part of the history, so seeks can't go back there anymore.
+         back = std::min(back, ring.size() - fill - chunk);
+
+         l.unlock();
+         ssize_t ret = pread(fd, &ring[tail], chunk, read_pos);
+         if (ret > 0)
+            posix_fadvise(fd, read_pos + ret + ring.size(), Internal::readahead_hint, POSIX_FADV_WILLNEED);
+         l.lock();
+
+         // Someone seeked somewhere else while we were reading.
+         if (gen != generation)
+            continue;
+
+         if (ret < 0 && errno == EINTR)
+            continue;
+         else if (ret < 0)
+            error = true;
+         else if (ret == 0)
+            eof = true;
+         else
+            fill += ret;
+
+         cond.notify_all();
+      }
+   }
+
+   MappedInput::MappedInput(const std::string& path) : Input(Internal::mapped_buffer_size), data(nullptr), size(0), pos(0), advised(0)
+   {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+         throw std::runtime_error(General::join("Failed to open ", path, "\n"));
+
+      struct stat st;
+      if (fstat(fd, &st) < 0 || st.st_size == 0)
+      {
+         close(fd);
+         throw std::runtime_error(General::join("Cannot map ", path, "\n"));
+      }
+      size = st.st_size;
+
+      void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      // The mapping keeps the file alive by itself.
+      close(fd);
+
+      if (map == MAP_FAILED)
+         throw std::runtime_error(General::join("Failed to map ", path, "\n"));
+
+      data = reinterpret_cast<const uint8_t*>(map);
+      madvise(map, size, MADV_SEQUENTIAL);
+      advise(0);
+   }
+
+   MappedInput::~MappedInput()
+   {
+      munmap(const_cast<uint8_t*>(data), size);
+   }
+
+   // Asks the kernel to start paging in what we'll read next, so we don't fault on every page.
+   void MappedInput::advise(size_t offset)
+   {
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t start = offset & ~(page - 1);
+      size_t len = std::min<size_t>(Internal::readahead_hint, size - start);
+
+      madvise(const_cast<uint8_t*>(data) + start, len, MADV_WILLNEED);
+      advised = start + len;
+   }
+
+   int MappedInput::read(uint8_t *buf, int in_size)
+   {
+      if (pos >= size)
+         return 0;
+
+      size_t to_read = std::min<size_t>(in_size, size - pos);
+      memcpy(buf, data + pos, to_read);
+      pos += to_read;
+
+      if (pos + Internal::readahead_hint / 2 > advised && advised < size)
+         advise(advised);
+
+      return to_read;
+   }
+
+   int64_t MappedInput::seek(int64_t offset, int whence)
+   {
+      int64_t target;
+      switch (whence)
+      {
+         case AVSEEK_SIZE:
+            return size;
+
+         case SEEK_SET:
+            target = offset;
+            break;
+
+         case SEEK_CUR:
+            target = pos + offset;
+            break;
+
+         case SEEK_END:
+            target = size + offset;
+            break;
+
+         default:
+            return -1;
+      }
+
+      if (target < 0)
+         return -1;
+
+      pos = target;
+      if (pos < size)
+         advise(pos);
+      return pos;
+   }
+}
+
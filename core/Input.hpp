@@ -0,0 +1,116 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __INPUT_HPP
+#define __INPUT_HPP
+
+#include "FF.hpp"
+#include "General.hpp"
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+namespace FF
+{
+   // A byte source for libavformat, hooked in through a custom AVIOContext.
+   class Input : private General::SmartDefs<Input>
+   {
+      public:
+         DECL_SMART(Input);
+         void operator=(const Input&) = delete;
+         Input(const Input&) = delete;
+         virtual ~Input();
+
+         // Returns bytes read, 0 on EOF and < 0 on error.
+         virtual int read(uint8_t *buf, int size) = 0;
+         // Same semantics as lseek(), with AVSEEK_SIZE returning the size of the stream.
+         virtual int64_t seek(int64_t offset, int whence) = 0;
+
+         AVIOContext* context();
+
+      protected:
+         // Reads bigger than buffer_size bypass the AVIOContext buffer and go straight into the caller's memory.
+         Input(int buffer_size = 32 * 1024);
+
+      private:
+         AVIOContext *ctx;
+         int buffer_size;
+
+         static int read_cb(void *data, uint8_t *buf, int size);
+         static int64_t seek_cb(void *data, int64_t offset, int whence);
+   };
+
+   // Reads a local file ahead of the demuxer on a separate thread, so a slow disk doesn't stall av_read_frame().
+   class PrefetchInput : public Input, private General::SmartDefs<PrefetchInput>
+   {
+      public:
+         DECL_SMART(PrefetchInput);
+         PrefetchInput(const std::string& path, size_t buffer_size = 16 * 1024 * 1024);
+         ~PrefetchInput();
+
+         int read(uint8_t *buf, int size);
+         int64_t seek(int64_t offset, int whence);
+
+      private:
+         int fd;
+         int64_t file_size;
+
+         // Ring buffer holding [pos - back, pos + fill) of the file. Data behind pos is kept around so short backwards seeks are free.
+         std::vector<uint8_t> ring;
+         size_t head;
+         size_t fill;
+         size_t back;
+         int64_t pos;
+         bool eof;
+         bool error;
+         unsigned generation;
+
+         bool thread_active;
+         std::mutex lock;
+         std::condition_variable cond;
+         std::thread thread;
+
+         void prefetch_thread();
+   };
+
+   // Maps the whole file and serves reads straight out of the mapping, so there are no syscalls on the read path.
+   class MappedInput : public Input, private General::SmartDefs<MappedInput>
+   {
+      public:
+         DECL_SMART(MappedInput);
+         MappedInput(const std::string& path);
+         ~MappedInput();
+
+         int read(uint8_t *buf, int size);
+         int64_t seek(int64_t offset, int whence);
+
+      private:
+         const uint8_t *data;
+         size_t size;
+         size_t pos;
+         size_t advised;
+
+         void advise(size_t offset);
+   };
+}
+
+#endif
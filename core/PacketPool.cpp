@@ -0,0 +1,190 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "PacketPool.hpp"
+#include <string.h>
+#include <algorithm>
+
+namespace FF
+{
+   PacketPool& PacketPool::get()
+   {
+      static PacketPool pool;
+      return pool;
+   }
+
+   PacketPool::PacketPool() : shell_hits(0), shell_misses(0), payload_hits(0), payload_misses(0),
+      budget(General::MemoryBudget::get().component("packet pool"))
+   {}
+
+   PacketPool::~PacketPool()
+   {
+      for (auto pkt : shells)
+         av_free(pkt);
+
+      for (auto& list : slabs)
+         for (auto slab : list)
+            av_free(slab);
+   }
+
+   AVPacket* PacketPool::alloc_shell()
+   {
+      AVPacket *pkt = nullptr;
+
+      lock.lock();
+      if (!shells.empty())
+      {
+         pkt = shells.back();
+         shells.pop_back();
+      }
+      lock.unlock();
+
+      if (pkt)
+      {
+         shell_hits++;
+         memset(pkt, 0, sizeof(*pkt));
+      }
+      else
+      {
+         shell_misses++;
+         pkt = (AVPacket*)av_mallocz(sizeof(AVPacket));
+      }
+
+      return pkt;
+   }
+
+   void PacketPool::free_shell(AVPacket *pkt)
+   {
+      std::lock_guard<std::mutex> f(lock);
+      if (shells.size() < max_cached_shells)
+         shells.push_back(pkt);
+      else
+         av_free(pkt);
+   }
+
+   unsigned PacketPool::size_to_class(size_t size)
+   {
+      unsigned size_class = 0;
+      while (size_class < num_classes && class_to_size(size_class) < size)
+         size_class++;
+      return size_class;
+   }
+
+   size_t PacketPool::class_to_size(unsigned size_class)
+   {
+      return size_t(1) << (size_class + min_class_log2);
+   }
+
+   uint8_t* PacketPool::alloc_payload(size_t size)
+   {
+      unsigned size_class = size_to_class(size);
+      uint8_t *slab = nullptr;
+
+      if (size_class < num_classes)
+      {
+         lock.lock();
+         auto& list = slabs[size_class];
+         if (!list.empty())
+         {
+            slab = list.back();
+            list.pop_back();
+            budget.sub(class_to_size(size_class));
+         }
+         lock.unlock();
+      }
+
+      if (slab)
+         payload_hits++;
+      else
+      {
+         payload_misses++;
+
+         // Oversized packets get a slab of their own which is freed right away when we're done.
+         size_t alloc_size = size_class < num_classes ? class_to_size(size_class) : size;
+         slab = (uint8_t*)av_malloc(header_size + alloc_size + FF_INPUT_BUFFER_PADDING_SIZE);
+         if (!slab)
+            return nullptr;
+
+         reinterpret_cast<SlabHeader*>(slab)->size_class = size_class;
+      }
+
+      return slab + header_size;
+   }
+
+   void PacketPool::free_payload(uint8_t *data)
+   {
+      uint8_t *slab = data - header_size;
+      unsigned size_class = reinterpret_cast<SlabHeader*>(slab)->size_class;
+
+      if (size_class < num_classes)
+      {
+         std::lock_guard<std::mutex> f(lock);
+         auto& list = slabs[size_class];
+
+         // Don't let a burst of huge packets pin down memory forever.
+         size_t max_slabs = std::max<size_t>(4, max_cached_bytes / class_to_size(size_class));
+         if (list.size() < max_slabs)
+         {
+            list.push_back(slab);
+            budget.add(class_to_size(size_class));
+            return;
+         }
+      }
+
+      av_free(slab);
+   }
+
+   void PacketPool::destruct(AVPacket *pkt)
+   {
+      if (pkt->data)
+         get().free_payload(pkt->data);
+      pkt->data = nullptr;
+      pkt->size = 0;
+   }
+
+   int PacketPool::dup(AVPacket& pkt)
+   {
+      // Packet already owns its data, nothing to do. Like av_dup_packet(), packets pointing into a buffer
+      // owned by the demuxer (nofree) are copied as well.
+      if ((pkt.destruct && pkt.destruct != av_destruct_packet_nofree) || !pkt.data)
+         return 0;
+
+      uint8_t *data = alloc_payload(pkt.size);
+      if (!data)
+         return -1;
+
+      memcpy(data, pkt.data, pkt.size);
+      memset(data + pkt.size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+      pkt.data = data;
+      pkt.destruct = &PacketPool::destruct;
+      return 0;
+   }
+
+   PacketPool::Stats PacketPool::stats() const
+   {
+      Stats stats;
+      stats.shell_hits = shell_hits;
+      stats.shell_misses = shell_misses;
+      stats.payload_hits = payload_hits;
+      stats.payload_misses = payload_misses;
+      return stats;
+   }
+}
+
@@ -0,0 +1,99 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PACKET_POOL_HPP
+#define __PACKET_POOL_HPP
+
+#include "FF.hpp"
+#include "Budget.hpp"
+#include <mutex>
+#include <atomic>
+#include <array>
+#include <vector>
+#include <stdint.h>
+
+namespace FF
+{
+   // Recycles AVPacket shells and packet payloads, so the demuxer doesn't have to hit the heap for every single packet.
+   // Payloads are handed out from power-of-two size classes and find their way back when av_free_packet() is called.
+   class PacketPool
+   {
+      public:
+         static PacketPool& get();
+
+         void operator=(const PacketPool&) = delete;
+         PacketPool(const PacketPool&) = delete;
+
+         AVPacket* alloc_shell();
+         void free_shell(AVPacket *pkt);
+
+         // Works like av_dup_packet(), but takes the payload from the pool.
+         int dup(AVPacket& pkt);
+
+         struct Stats
+         {
+            uint64_t shell_hits;
+            uint64_t shell_misses;
+            uint64_t payload_hits;
+            uint64_t payload_misses;
+         };
+
+         Stats stats() const;
+
+      private:
+         PacketPool();
+         ~PacketPool();
+
+         enum : size_t
+         {
+            min_class_log2 = 10,
+            max_class_log2 = 22,
+            num_classes = max_class_log2 - min_class_log2 + 1,
+            header_size = 32,
+            max_cached_bytes = 16 << 20,
+            max_cached_shells = 1024
+         };
+
+         struct SlabHeader
+         {
+            unsigned size_class;
+         };
+
+         std::mutex lock;
+         std::vector<AVPacket*> shells;
+         std::array<std::vector<uint8_t*>, num_classes> slabs;
+
+         std::atomic<uint64_t> shell_hits;
+         std::atomic<uint64_t> shell_misses;
+         std::atomic<uint64_t> payload_hits;
+         std::atomic<uint64_t> payload_misses;
+
+         // Slabs sitting in the free lists still count towards our memory use.
+         General::MemoryBudget::Component& budget;
+
+         uint8_t* alloc_payload(size_t size);
+         void free_payload(uint8_t *data);
+
+         static unsigned size_to_class(size_t size);
+         static size_t class_to_size(unsigned size_class);
+         static void destruct(AVPacket *pkt);
+   };
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __RING_HPP
+#define __RING_HPP
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+#include <stddef.h>
+
+namespace General
+{
+   // Bounded lock-free ring for exactly one producer and one consumer thread.
+   // push() may only be called from the producer, front()/pop() only from the consumer.
+   template <class T>
+   class SPSCRing
+   {
+      public:
+         SPSCRing(size_t in_capacity) : head(0), tail(0)
+         {
+            size_t cap = 1;
+            while (cap < in_capacity)
+               cap <<= 1;
+
+            mask = cap - 1;
+            slots = std::unique_ptr<Storage[]>(new Storage[cap]);
+         }
+
+         ~SPSCRing()
+         {
+            while (!empty())
+               pop();
+         }
+
+         void operator=(const SPSCRing&) = delete;
+         SPSCRing(const SPSCRing&) = delete;
+
+         bool push(T&& in)
+         {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - head.load(std::memory_order_acquire) > mask)
+               return false;
+
+            new (&slots[t & mask]) T(std::move(in));
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+         }
+
+         T& front()
+         {
+            size_t h = head.load(std::memory_order_relaxed);
+            return *reinterpret_cast<T*>(&slots[h & mask]);
+         }
+
+         void pop()
+         {
+            size_t h = head.load(std::memory_order_relaxed);
+            reinterpret_cast<T*>(&slots[h & mask])->~T();
+            head.store(h + 1, std::memory_order_release);
+         }
+
+         size_t size() const
+         {
+            size_t h = head.load(std::memory_order_acquire);
+            size_t t = tail.load(std::memory_order_acquire);
+            return t - h;
+         }
+
+         bool empty() const { return size() == 0; }
+         bool full() const { return size() > mask; }
+         size_t capacity() const { return mask + 1; }
+
+      private:
+         typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+         std::unique_ptr<Storage[]> slots;
+         size_t mask;
+
+         // Keep consumer and producer indices on separate cache lines.
+         alignas(64) std::atomic<size_t> head;
+         alignas(64) std::atomic<size_t> tail;
+   };
+
+   // Lock-free ring of plain samples for one producer and one consumer thread, copied in and out in bulk.
+   // write() may only be called from the producer, read() only from the consumer.
+   template <class T>
+   class SampleRing
+   {
+      public:
+         SampleRing() : mask(0), head(0), tail(0) {}
+
+         void operator=(const SampleRing&) = delete;
+         SampleRing(const SampleRing&) = delete;
+
+         // Throws away anything buffered. Neither side may be running.
+         void reset(size_t in_capacity)
+         {
+            size_t cap = 1;
+            while (cap < in_capacity)
+               cap <<= 1;
+
+            if (cap != mask + 1 || !buf)
+            {
+               buf = std::unique_ptr<T[]>(new T[cap]);
+               mask = cap - 1;
+            }
+            head = 0;
+            tail = 0;
+         }
+
+         // Returns how many samples fit.
+         size_t write(const T *in, size_t samples)
+         {
+            size_t t = tail.load(std::memory_order_relaxed);
+            samples = std::min(samples, capacity() - (t - head.load(std::memory_order_acquire)));
+
+            size_t first = std::min(samples, capacity() - (t & mask));
+            std::copy(in, in + first, &buf[t & mask]);
+            std::copy(in + first, in + samples, &buf[0]);
+
+            tail.store(t + samples, std::memory_order_release);
+            return samples;
+         }
+
+         size_t read(T *out, size_t samples)
+         {
+            size_t h = head.load(std::memory_order_relaxed);
+            samples = std::min(samples, tail.load(std::memory_order_acquire) - h);
+
+            size_t first = std::min(samples, capacity() - (h & mask));
+            std::copy(&buf[h & mask], &buf[h & mask] + first, out);
+            std::copy(&buf[0], &buf[0] + (samples - first), out + first);
+
+            head.store(h + samples, std::memory_order_release);
+            return samples;
+         }
+
+         size_t read_avail() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+         size_t write_avail() const { return capacity() - read_avail(); }
+         size_t capacity() const { return buf ? mask + 1 : 0; }
+
+      private:
+         std::unique_ptr<T[]> buf;
+         size_t mask;
+
+         alignas(64) std::atomic<size_t> head;
+         alignas(64) std::atomic<size_t> tail;
+   };
+}
+
+#endif
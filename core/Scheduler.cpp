@@ -21,10 +21,12 @@
 
 #include "FF.hpp"
 #include "AV.hpp"
+#include "PacketPool.hpp"
 #include "Scheduler.hpp"
 #include "audio/alsa.hpp"
 #include "audio/null.hpp"
 #include "video/opengl.hpp"
+#include "video/null.hpp"
 #include "subs/ASSRender.hpp"
 #include <iostream>
 #include <array>
@@ -32,6 +34,8 @@
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <cmath>
+#include <sys/resource.h>
 
 using namespace FF;
 using namespace AV::Audio;
@@ -40,37 +44,106 @@ using namespace AV::Sub;
 
 namespace AV
 {
-   Scheduler::Scheduler(MediaFile::Ptr in_file) : file(in_file), is_active(true), video_pts(0.0), audio_pts(0.0), audio_pts_ts(get_time()), video_pts_ts(get_time()), audio_written(0), is_paused(false), video_thread_active(false), audio_thread_active(false)
+   // Video gets a lot of room in bytes since high bitrate streams need a few seconds buffered as well.
+   // Subtitle packets are sparse, so only their size makes sense as a limit.
+   Scheduler::Options::Options() :
+      video_limits(512 * 1024, 64 * 1024 * 1024, 0.5, 5.0),
+      audio_limits(16 * 1024, 4 * 1024 * 1024, 0.5, 5.0),
+      sub_limits(0, 1024 * 1024),
+      decoded_frames(4),
+      accurate_seek(false),
+      sync(Sync::Audio),
+      drift_correction(true),
+      audio_buffer(0.5),
+      lock_memory(false),
+      timer_slack(0.0015),
+      benchmark(false),
+      benchmark_present(false)
+   {}
+
+   Scheduler::Scheduler(MediaFile::Ptr in_file, const Options& in_opts) : file(in_file), opts(in_opts), is_active(true), video_pts(0.0), audio_written(0), sync_mode(in_opts.sync), clock_started(false), is_paused(false), seek_pending(false), pending_target(0.0), seek_serial(0), video_seek_serial(0), audio_seek_serial(0), seek_target(0.0), decode_pts(0.0), decoder_pending(0), skip_level(0), late_frames(0), on_time_frames(0), frames_dropped(0), frames_skipped(0), demux_thread_active(true), demux_eof(false), video_thread_active(false), audio_thread_active(false), frame_queue(in_opts.decoded_frames), frame_timer(in_opts.timer_slack), audio_samples(0), audio_underruns(0), packets_dropped(0), start_time(General::PrecisionTimer::now()), decoded_format(Audio::SampleFormat::S16), out_rate(0), out_channels(0), drift_ratio(0.0)
    {
       has_video = file->video().active;
       has_audio = file->audio().active;
 
+      if (opts.lock_memory)
+         General::lock_memory();
+
+      // Nothing is paced when benchmarking, so there's nothing to correct either.
+      if (opts.benchmark)
+         opts.drift_correction = false;
+
+      // Can't sync to something we don't have, so just follow the system clock.
+      if ((sync_mode == Sync::Audio && !has_audio) || (sync_mode == Sync::Video && !has_video))
+         sync_mode = Sync::External;
+
+      vid_pkt_queue.set_limits(opts.video_limits);
+      aud_pkt_queue.set_limits(opts.audio_limits);
+      sub_pkt_queue.set_limits(opts.sub_limits);
+
+      if (has_video)
+         vid_pkt_queue.set_time_base(file->video().time_base);
+      if (has_audio)
+         aud_pkt_queue.set_time_base(file->audio().time_base);
+
+      auto& budget = General::MemoryBudget::get();
+      vid_pkt_queue.set_budget(&budget.component("video packets"));
+      aud_pkt_queue.set_budget(&budget.component("audio packets"));
+      sub_pkt_queue.set_budget(&budget.component("subtitle packets"));
+      frame_queue.set_budget(&budget.component("decoded frames"));
+
+      vid_pkt_queue.set_drain_event(&demux_cond);
+      aud_pkt_queue.set_drain_event(&demux_cond);
+      sub_pkt_queue.set_drain_event(&demux_cond);
+
       if (has_video)
       {
          video_thread_active = true;
          video_thread = std::thread(&Scheduler::video_thread_fn, this);
+         video_decode_thread = std::thread(&Scheduler::video_decode_thread_fn, this);
       }
       if (has_audio)
       {
          audio_thread_active = true;
          audio_thread = std::thread(&Scheduler::audio_thread_fn, this);
       }
+
+      demux_thread = std::thread(&Scheduler::demux_thread_fn, this);
+
+      // We're on the control thread here. New threads inherit affinity, scheduling class and niceness,
+      // so this has to wait until the others are running.
+      General::setup_thread("control", opts.threads.control);
    }
 
    Scheduler::~Scheduler()
    {
+      demux_thread_active = false;
       video_thread_active = false;
       audio_thread_active = false;
 
+      // Wake up anyone sleeping on a queue so they notice we're going down.
+      aud_pkt_queue.signal();
+      vid_pkt_queue.signal();
+      sub_pkt_queue.signal();
+      frame_queue.signal();
+      demux_cond.signal();
+      pause_cond.signal();
+      pcm_cond.signal();
+
+      demux_thread.join();
       if (has_video)
+      {
+         video_decode_thread.join();
          video_thread.join();
+      }
       if (has_audio)
          audio_thread.join();
    }
 
    bool Scheduler::active() const
    {
-      bool res = is_active || audio_thread_active || video_thread_active;
+      // Once the demuxer is done, we're only around as long as something is still playing.
+      bool res = (is_active && !demux_eof) || audio_thread_active || video_thread_active;
       return res;
    }
 
@@ -93,69 +166,277 @@ namespace AV
    void Scheduler::pause_toggle()
    {
       avlock.lock();
-      is_paused = !is_paused;
+      set_paused(!is_paused);
       avlock.unlock();
    }
 
-   void Scheduler::perform_seek(double time)
+   void Scheduler::set_paused(bool paused)
+   {
+      is_paused = paused;
+      audio_clock.pause(paused);
+      video_clock.pause(paused);
+      external_clock.pause(paused);
+      pause_cond.signal();
+      pcm_cond.signal();
+   }
+
+   Clock& Scheduler::master_clock()
    {
+      switch (sync_mode.load())
+      {
+         case Sync::Video:
+            return video_clock;
+         case Sync::External:
+            return external_clock;
+         default:
+            return audio_clock;
+      }
+   }
+
+   // The external clock starts running with whatever gets played first, so it doesn't count time spent filling up buffers.
+   void Scheduler::start_clock(double pts)
+   {
+      if (!clock_started.exchange(true))
+         external_clock.reset(pts);
+   }
+
+   // Only bookkeeping happens here, the demuxer does the actual seek, so holding down a seek key doesn't pile up work.
+   void Scheduler::request_seek(double delta)
+   {
+      General::Tracer::get().instant("seek request");
+      std::lock_guard<std::mutex> f(seek_lock);
+
+      // If the last request hasn't been carried out yet, stack on top of it instead of the position we're still showing.
+      double base = pending_target;
+      if (!seek_pending)
+      {
+         avlock.lock();
+         base = has_video ? video_pts : audio_clock.get();
+         avlock.unlock();
+      }
+      pending_target = std::max(base + delta, 0.0);
+
+      // Stop the decoders from chewing on packets we're going to throw away anyway,
+      // and make sure whatever the demuxer is holding on to right now doesn't get queued.
+      demux_lock.lock();
+      seek_serial++;
+      seek_target = pending_target;
+      unsigned audio_serial = aud_pkt_queue.clear();
+      unsigned video_serial = vid_pkt_queue.clear();
+      if (opts.accurate_seek)
+      {
+         audio_seek_serial = audio_serial;
+         video_seek_serial = video_serial;
+      }
+      seek_pending = true;
+      demux_lock.unlock();
+
       avlock.lock();
+      set_paused(false);
+      avlock.unlock();
+      demux_cond.signal();
+      pcm_cond.signal();
+   }
 
-      if (sub_renderer.get() != nullptr)
+   // Called from the demuxer thread. Decoders flush themselves when they see the new queue serial.
+   // Returns the serial of the request that was carried out, which is what packets read afterwards belong to.
+   unsigned Scheduler::perform_seek()
+   {
+      seek_lock.lock();
+      // Requests bump the serial while holding seek_lock, so this is the one matching pending_target.
+      unsigned serial = seek_serial;
+      if (!seek_pending)
       {
-         gfx_lock.lock();
-         sub_renderer->flush();
-         gfx_lock.unlock();
+         seek_lock.unlock();
+         return serial;
       }
 
-      if (has_audio)
+      double target = pending_target;
+
+      avlock.lock();
+      double current = has_video ? video_pts : audio_clock.get();
+      audio_written += file->audio().rate * file->audio().channels * (target - current) * 2;
+      video_pts = target;
+      audio_clock.reset(target);
+      video_clock.reset(target);
+      external_clock.reset(target);
+      clock_started = false;
+      avlock.unlock();
+
+      seek_pending = false;
+      seek_lock.unlock();
+
+      // Decoders that haven't run dry yet pick up from the new position. The rest are gone, and their queues stay closed.
+      if (demux_eof)
       {
-         audio_lock.lock();
-         audio->pause();
-         audio_lock.unlock();
+         aud_pkt_queue.reopen();
+         vid_pkt_queue.reopen();
+         sub_pkt_queue.reopen();
+         demux_eof = false;
+      }
+
+      General::TraceScope t("seek");
+      try
+      {
+         // Accurate seeks decode up to the target, so they have to start at a keyframe before it.
+         file->seek(current, current, target - current, SeekTarget::Default, opts.accurate_seek);
+      }
+      catch (std::exception& e)
+      {
+         // Just keep playing from where we are.
+         std::cerr << e.what() << std::endl;
       }
 
-      video_pts += time;
+      return serial;
+   }
 
-      audio_written += file->audio().rate * file->audio().channels * time * 2;
-      file->seek(video_pts, audio_pts, time);
+   namespace Internal
+   {
+      // How often waits on the audio device check whether it's still alive.
+      static const double device_poll = 0.1;
 
-      if (has_audio)
+      // avcodec_decode_audio3() only ever hands out packed audio, planar formats only show up with a single channel.
+      static Audio::SampleFormat sample_format(AVSampleFormat fmt)
       {
-         audio_lock.lock();
-         audio->unpause();
-         audio_lock.unlock();
+         switch (fmt)
+         {
+            case AV_SAMPLE_FMT_U8:
+            case AV_SAMPLE_FMT_U8P:
+               return Audio::SampleFormat::U8;
+            case AV_SAMPLE_FMT_S32:
+            case AV_SAMPLE_FMT_S32P:
+               return Audio::SampleFormat::S32;
+            case AV_SAMPLE_FMT_FLT:
+            case AV_SAMPLE_FMT_FLTP:
+               return Audio::SampleFormat::Float;
+            case AV_SAMPLE_FMT_DBL:
+            case AV_SAMPLE_FMT_DBLP:
+               return Audio::SampleFormat::Double;
+            default:
+               return Audio::SampleFormat::S16;
+         }
       }
 
-      aud_pkt_queue.clear();
-      vid_pkt_queue.clear();
-      avlock.unlock();
-      is_paused = false;
+      static void report_stage(std::ostream& out, const char *name, const General::Stage& stage, bool last)
+      {
+         out << "      \"" << name << "\": { \"count\": " << stage.count() << ", \"total_s\": " << stage.total() <<
+            ", \"mean_us\": " << stage.mean() * 1000000.0 <<
+            ", \"p50_us\": " << stage.percentile(0.5) * 1000000.0 <<
+            ", \"p99_us\": " << stage.percentile(0.99) * 1000000.0 << " }" << (last ? "" : ",") << "\n";
+      }
+   }
+
+   std::vector<std::pair<const char*, const General::Stage*>> Scheduler::stages() const
+   {
+      return {
+         { "demux", &demux_stage },
+         { "video_decode", &video_decode_stage },
+         { "frame_copy", &frame_copy_stage },
+         { "upload", &upload_stage },
+         { "subtitles", &subtitle_stage },
+         { "flip", &flip_stage },
+         { "audio_decode", &audio_decode_stage },
+         { "audio_convert", &audio_convert_stage },
+         { "audio_output", &audio_output_stage },
+         { "avlock_wait", &avlock.waits() },
+         { "gfx_lock_wait", &gfx_lock.waits() },
+         { "audio_lock_wait", &audio_lock.waits() },
+      };
+   }
+
+   void Scheduler::report(std::ostream& out)
+   {
+      double wall = General::PrecisionTimer::now() - start_time;
+      uint64_t frames = frame_copy_stage.count();
+      uint64_t shown = flip_stage.count();
+      uint64_t samples = audio_samples;
+
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+
+      out << "{\n";
+      out << "   \"wall_s\": " << wall << ",\n";
+      out << "   \"demux\": { \"packets_dropped\": " << packets_dropped << " },\n";
+      out << "   \"video\": { \"frames_decoded\": " << frames << ", \"frames_presented\": " << shown <<
+         ", \"fps\": " << (wall > 0.0 ? frames / wall : 0.0) << " },\n";
+      out << "   \"audio\": { \"samples\": " << samples << ", \"samples_per_s\": " << (wall > 0.0 ? samples / wall : 0.0) <<
+         ", \"realtime_factor\": " << (wall > 0.0 && has_audio && out_rate ? samples / (wall * out_rate) : 0.0) <<
+         ", \"underruns\": " << audio_underruns << ", \"simd\": \"" << Audio::simd_level() << "\" },\n";
+      auto timer = frame_timer.stats();
+      out << "   \"frame_timer\": { \"waits\": " << timer.waits << ", \"mean_overshoot_us\": " << timer.mean_error * 1000000.0 <<
+         ", \"max_overshoot_us\": " << timer.max_error * 1000000.0 << ", \"oversleeps\": " << timer.oversleeps << " },\n";
+      out << "   \"stages\": {\n";
+      auto list = stages();
+      for (unsigned i = 0; i < list.size(); i++)
+         Internal::report_stage(out, list[i].first, *list[i].second, i == list.size() - 1);
+      out << "   },\n";
+      auto pool = FF::PacketPool::get().stats();
+      out << "   \"packet_pool\": { \"shell_hits\": " << pool.shell_hits << ", \"shell_misses\": " << pool.shell_misses <<
+         ", \"payload_hits\": " << pool.payload_hits << ", \"payload_misses\": " << pool.payload_misses << " },\n";
+      auto& budget = General::MemoryBudget::get();
+      out << "   \"memory\": { \"peak_buffered_bytes\": " << budget.peak() <<
+         ", \"max_rss_bytes\": " << (uint64_t)usage.ru_maxrss * 1024 << ", \"components\": {";
+      auto components = budget.report();
+      for (unsigned i = 0; i < components.size(); i++)
+      {
+         out << (i ? ", " : " ") << "\"" << components[i].name << "\": { \"bytes\": " << components[i].bytes <<
+            ", \"peak_bytes\": " << components[i].peak << " }";
+      }
+      out << " } }\n";
+      out << "}" << std::endl;
    }
 
    void Scheduler::show_info()
    {
+      std::vector<IO::InfoOutput::StageInfo> info;
+      if (!info_handlers.empty())
+      {
+         for (auto& stage : stages())
+         {
+            IO::InfoOutput::StageInfo entry = { stage.first, stage.second->count(), stage.second->mean(),
+               stage.second->percentile(0.5), stage.second->percentile(0.99) };
+            info.push_back(entry);
+         }
+      }
+
+      auto timer = frame_timer.stats();
+      std::vector<IO::InfoOutput::MemoryInfo> memory;
+      if (!info_handlers.empty())
+      {
+         for (auto& comp : General::MemoryBudget::get().report())
+         {
+            IO::InfoOutput::MemoryInfo entry = { comp.name, comp.bytes, comp.peak };
+            memory.push_back(entry);
+         }
+      }
+
+      double drift = audio_clock.drift();
       for (auto& ptr : info_handlers)
       {
-         double time = get_time();
-         if (is_paused)
-            ptr->output(video_pts, audio_pts, file->video().active, file->audio().active);
-         else
-            ptr->output(video_pts + (time - video_pts_ts), audio_pts + (time - audio_pts_ts), file->video().active, file->audio().active);
+         ptr->frame_stats(frames_dropped, frames_skipped);
+         ptr->clock_stats(drift);
+         ptr->stage_stats(info);
+         ptr->timer_stats(timer.mean_error, timer.max_error, timer.oversleeps);
+         ptr->memory_stats(memory, General::MemoryBudget::get().limit());
+
+         ptr->output(video_clock.get(), audio_clock.get(), file->video().active, file->audio().active);
       };
    }
 
    void Scheduler::run()
    {
+      static const double info_interval = 0.05;
+
+      // Nothing changes on screen while paused, so only input can wake us up then.
+      control_loop.set_interval(is_paused ? 0.0 : info_interval);
+      control_loop.wait();
+
       avlock.lock();
       auto event = next_event();
       avlock.unlock();
 
-      if (!is_active)
-      {
-         sync_sleep(0.01);
+      if (!active())
          return;
-      }
 
       show_info();
 
@@ -163,6 +444,7 @@ namespace AV
       {
          case EventHandler::Event::Quit:
             is_active = false;
+            demux_thread_active = false;
             video_thread_active = false;
             audio_thread_active = false;
             return;
@@ -172,19 +454,19 @@ namespace AV
             break;
 
          case EventHandler::Event::SeekBack10:
-            perform_seek(-3.0);
+            request_seek(-3.0);
             break;
 
          case EventHandler::Event::SeekForward10:
-            perform_seek(3.0);
+            request_seek(3.0);
             break;
 
          case EventHandler::Event::SeekBack60:
-            perform_seek(-30.0);
+            request_seek(-30.0);
             break;
 
          case EventHandler::Event::SeekForward60:
-            perform_seek(30.0);
+            request_seek(30.0);
             break;
 
          case EventHandler::Event::Fullscreen:
@@ -198,53 +480,46 @@ namespace AV
          default:
             throw std::runtime_error("Unknown event popped up :V\n");
       }
+   }
 
-      if (is_paused)
-      {
-         sync_sleep(0.01);
-         return;
-      }
-
-      Packet pkt;
-
-      Packet::Type type = file->packet(pkt);
-
-      switch(type)
+   bool Scheduler::queues_full(Packet::Type type) const
+   {
+      const PacketQueue *queue = nullptr;
+      switch (type)
       {
-         case Packet::Type::Error:
-            is_active = false;
-            // Signal to threads that there won't be any more data.
-            aud_pkt_queue.finalize();
-            vid_pkt_queue.finalize();
-            return;
-            
-         case Packet::Type::None:
-            return;
-
          case Packet::Type::Audio:
-            while (aud_pkt_queue.size() > 16 && (vid_pkt_queue.size() > 16 || !has_video))
-               aud_pkt_queue.wait();
-
-            aud_pkt_queue.push(std::move(pkt));
+            queue = &aud_pkt_queue;
             break;
 
          case Packet::Type::Video:
-            while (vid_pkt_queue.size() > 16 && (aud_pkt_queue.size() > 16 || !has_audio))
-               vid_pkt_queue.wait();
-
-            vid_pkt_queue.push(std::move(pkt));
+            queue = &vid_pkt_queue;
             break;
 
          case Packet::Type::Subtitle:
-            while (sub_pkt_queue.size() > 64 && (aud_pkt_queue.size() > 16 || !has_audio) && (vid_pkt_queue.size() > 16 || !has_video))
-               sub_pkt_queue.wait();
-
-            sub_pkt_queue.push(std::move(pkt));
+            queue = &sub_pkt_queue;
             break;
 
          default:
-            throw std::runtime_error("What kind of package is this? o.o\n");
+            return false;
       }
+
+      // Subtitles are only drained while video is presented, so never hold up audio and video for them.
+      // A full subtitle queue just drops the packet.
+      if (queue->full())
+         return type != Packet::Type::Subtitle;
+      if (!queue->above_high() && !General::MemoryBudget::get().exceeded())
+         return false;
+      // Going over the memory budget is better than starving a stream completely.
+      if (queue->below_low())
+         return false;
+
+      // Keep feeding if another stream is running dry, even if this queue goes above its high watermark.
+      if (type != Packet::Type::Audio && has_audio && aud_pkt_queue.below_low())
+         return false;
+      if (type != Packet::Type::Video && has_video && vid_pkt_queue.below_low())
+         return false;
+
+      return true;
    }
 
    void Scheduler::sync_sleep(float secs)
@@ -252,14 +527,6 @@ namespace AV
       std::this_thread::sleep_for(std::chrono::nanoseconds((int64_t)(secs * 1000000000)));
    }
 
-   double Scheduler::get_time()
-   {
-      auto clock = std::chrono::monotonic_clock::now();
-      std::chrono::nanoseconds time = clock.time_since_epoch();
-      double secs = time.count() * 0.000000001;
-      return secs;
-   }
-
    double Scheduler::frame_time() const
    {
       double frame_time = av_q2d(file->video().ctx->time_base) * file->video().ctx->ticks_per_frame;
@@ -268,41 +535,109 @@ namespace AV
       return frame_time;
    }
 
-   void Scheduler::process_video(AVPacket& pkt, Display::Ptr vid, AVFrame *frame)
+   // Returns false if we're still catching up to hide_before, and nothing was queued for presentation.
+   bool Scheduler::process_video(AVPacket& pkt, AVFrame *frame, unsigned serial, double hide_before)
    {
-      if (!has_video)
-         return;
-
       int finished = 0;
 
-      uint64_t pts = pkt.pts;
-      FF::set_global_pts(pkt.pts);
+      // While we're well behind the seek target, nobody will see non-reference frames, so don't bother decoding them properly.
+      AVCodecContext *ctx = file->video().ctx;
+      int64_t pkt_ts = pkt.dts != (int64_t)AV_NOPTS_VALUE ? pkt.dts : pkt.pts;
+      bool far_behind = hide_before >= 0.0 && pkt_ts != (int64_t)AV_NOPTS_VALUE &&
+         pkt_ts * av_q2d(file->video().time_base) < hide_before - 2.0 * frame_time();
 
-      gfx_lock.lock();
-      avcodec_decode_video2(file->video().ctx, frame, &finished, &pkt);
-      gfx_lock.unlock();
+      // Otherwise, cut corners as far as the presenter tells us to keep up.
+      unsigned level = far_behind ? 2 : skip_level.load();
+      ctx->skip_frame = level >= 2 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+      ctx->skip_loop_filter = level >= 3 ? AVDISCARD_ALL : (level >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
 
-      if (pkt.dts == (int64_t)AV_NOPTS_VALUE && frame->opaque && *(uint64_t*)frame->opaque != AV_NOPTS_VALUE)
-         pts = *(uint64_t*)frame->opaque;
-      else if (pkt.dts != (int64_t)AV_NOPTS_VALUE)
-         pts = pkt.dts;
+      // With frame threading, the frame we get back belongs to a packet we sent in a while ago.
+      // libavcodec hands reordered_opaque back with the frame it was set for, so stash the timestamp there.
+      ctx->reordered_opaque = pkt.pts != (int64_t)AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+
+      {
+         General::StageTimer t(video_decode_stage, "video decode");
+         avcodec_decode_video2(ctx, frame, &finished, &pkt);
+      }
+
+      // Frame threads and reordering hold on to a few pictures, so no picture out isn't necessarily a skipped one.
+      // Only once more went in than the decoder holds on to, a picture must have been thrown away.
+      unsigned delay = ctx->has_b_frames;
+      if (ctx->active_thread_type & FF_THREAD_FRAME)
+         delay += std::max(ctx->thread_count - 1, 0);
+
+      decoder_pending++;
+      if (finished || decoder_pending > delay)
+      {
+         decoder_pending--;
+         if (!finished && !far_behind && ctx->skip_frame != AVDISCARD_DEFAULT)
+            frames_skipped++;
+      }
 
       if (finished)
+         return queue_frame(frame, serial, hide_before);
+
+      return hide_before < 0.0;
+   }
+
+   // Returns false if the picture was before hide_before and got thrown away.
+   bool Scheduler::queue_frame(AVFrame *frame, unsigned serial, double hide_before)
+   {
+      int64_t pts = frame->reordered_opaque;
+      if (pts != (int64_t)AV_NOPTS_VALUE)
+         decode_pts = pts * av_q2d(file->video().time_base);
+      else
+         decode_pts += frame_time();
+
+      decode_pts += frame->repeat_pict / (2.0 * frame_time());
+
+      // Allow for half a frame of slack, the target is hardly ever exactly on a frame.
+      if (hide_before >= 0.0 && decode_pts < hide_before - 0.5 * frame_time())
+         return false;
+
+      // Run ahead of the presenter, but only by as many frames as the queue holds.
       {
-         if (pts != AV_NOPTS_VALUE)
-            video_pts = pts * av_q2d(file->video().time_base);
-         else
-            video_pts += frame_time();
+         General::TraceScope t("frame queue full");
+         frame_queue.wait_until([this]() {
+               return !frame_queue.full() || !video_thread_active;
+            });
+      }
+      General::StageTimer t(frame_copy_stage, "frame copy");
+      frame_queue.push(frame, file->video().width, file->video().height, file->video().ctx->pix_fmt, decode_pts, serial);
+      return true;
+   }
+
+   // Frame threads and reordering hold on to the last few pictures until they're fed empty packets.
+   void Scheduler::drain_video(AVFrame *frame, unsigned serial, double hide_before)
+   {
+      AVCodecContext *ctx = file->video().ctx;
+      ctx->skip_frame = AVDISCARD_DEFAULT;
+      ctx->skip_loop_filter = AVDISCARD_DEFAULT;
+
+      AVPacket pkt;
+      av_init_packet(&pkt);
+      pkt.data = nullptr;
+      pkt.size = 0;
+
+      int finished = 1;
+      while (finished && video_thread_active)
+      {
+         {
+            General::StageTimer t(video_decode_stage, "video decode");
+            if (avcodec_decode_video2(ctx, frame, &finished, &pkt) < 0)
+               break;
+         }
 
-         video_pts += frame->repeat_pict / (2.0 * frame_time());
-         vid->frame(frame->data, frame->linesize, file->video().width, file->video().height);
+         if (finished)
+            queue_frame(frame, serial, hide_before);
       }
    }
 
-   void Scheduler::process_audio(AVPacket& pkt, AlignedBuffer<int16_t>& buf)
+   // Returns false if the whole packet was before trim_before and got thrown away.
+   bool Scheduler::process_audio(AVPacket& pkt, AlignedBuffer<int16_t>& buf, unsigned serial, double trim_before)
    {
       if (!has_audio)
-         return;
+         return true;
 
       uint8_t *data = pkt.data;
       size_t size = pkt.size;
@@ -312,7 +647,12 @@ namespace AV
       {
          int out_size = buf.size() * sizeof(int16_t) - written;
          audio_lock.lock();
-         int ret = avcodec_decode_audio3(file->audio().ctx, &buf[written / sizeof(int16_t)], &out_size, &pkt);
+         int ret;
+         {
+            General::StageTimer t(audio_decode_stage, "audio decode");
+            int16_t *dst = reinterpret_cast<int16_t*>(reinterpret_cast<uint8_t*>(&buf[0]) + written);
+            ret = avcodec_decode_audio3(file->audio().ctx, dst, &out_size, &pkt);
+         }
          audio_lock.unlock();
          if (ret <= 0)
             break;
@@ -324,20 +664,140 @@ namespace AV
       pkt.data = data;
       pkt.size = size;
 
-      audio_lock.lock();
-      audio->write(&buf[0], written / 2);
-      audio_lock.unlock();
+      int64_t pkt_ts = pkt.pts != (int64_t)AV_NOPTS_VALUE ? pkt.pts : pkt.dts;
+      double pkt_pts = pkt_ts != (int64_t)AV_NOPTS_VALUE ? pkt_ts * av_q2d(file->audio().time_base) : 0.0;
 
-      avlock.lock();
-      audio_written += written;
+      // Cut away whatever comes before the seek target, on a frame boundary.
+      size_t frame_size = file->audio().channels * Audio::Converter::bytes_per_sample(decoded_format);
+      size_t skip = 0;
+      if (trim_before >= 0.0 && pkt_ts != (int64_t)AV_NOPTS_VALUE && pkt_pts < trim_before)
+      {
+         skip = std::min<size_t>(written / frame_size, (trim_before - pkt_pts) * file->audio().rate) * frame_size;
+         pkt_pts += (double)skip / (frame_size * file->audio().rate);
+      }
+
+      if (skip >= written && written > 0)
+         return false;
 
-      if (pkt.pts != (int64_t)AV_NOPTS_VALUE)
-         audio_pts = pkt.pts * av_q2d(file->audio().time_base) - audio->delay();
-      else if (pkt.dts != (int64_t)AV_NOPTS_VALUE)
-         audio_pts = pkt.dts * av_q2d(file->audio().time_base) - audio->delay();
+      const uint8_t *decoded = reinterpret_cast<const uint8_t*>(&buf[0]) + skip;
+      size_t frames = (written - skip) / frame_size;
+      double duration = (double)frames / file->audio().rate;
+
+      unsigned channels = out_channels;
+      const int16_t *out = reinterpret_cast<const int16_t*>(decoded);
+      size_t samples = frames * channels;
+      if (!converter.passthrough())
+      {
+         General::StageTimer t(audio_convert_stage, "audio convert");
+         samples = converter.process(&decoded, frames, converted) * channels;
+         out = converted.data();
+      }
+
+      if (opts.drift_correction && &master_clock() != &audio_clock && samples > 0)
+      {
+         update_drift_correction();
+         samples = resampler.process(out, samples / channels, resampled) * channels;
+         out = &resampled[0];
+      }
+
+      {
+         General::StageTimer t(audio_output_stage, "audio write");
+         queue_audio(out, samples, serial);
+      }
+      audio_samples += samples / channels;
 
-      audio_pts_ts = get_time();
+      avlock.lock();
+      audio_written += written - skip;
       avlock.unlock();
+
+      // Whatever is still in the ring and the device plays before the end of this packet.
+      if (pkt_ts != (int64_t)AV_NOPTS_VALUE)
+      {
+         double pts = pkt_pts + duration - (double)pcm_ring.read_avail() / (channels * out_rate) - audio->delay();
+         audio_clock.set(pts);
+         start_clock(pts);
+      }
+      return true;
+   }
+
+   // Blocks until everything is in the ring, or a seek or shutdown makes it pointless.
+   // A dead device drops everything, like write() did, so playback goes on without sound.
+   void Scheduler::queue_audio(const int16_t *samples, size_t count, unsigned serial)
+   {
+      size_t done = 0;
+      while (done < count && audio_thread_active && audio->alive() && aud_pkt_queue.current_serial() == serial)
+      {
+         if (is_paused)
+         {
+            wait_unpaused();
+            continue;
+         }
+
+         done += pcm_ring.write(samples + done, count - done);
+         if (done < count)
+         {
+            // The device's thread just stops when the device gives up, so don't count on it to wake us up.
+            pcm_cond.wait_for([this, serial]() {
+                  return pcm_ring.write_avail() > 0 || is_paused || !audio_thread_active || !audio->alive() ||
+                     aud_pkt_queue.current_serial() != serial;
+               }, Internal::device_poll);
+         }
+      }
+   }
+
+   ssize_t Scheduler::audio_callback(int16_t *out, size_t frames, void *data)
+   {
+      return static_cast<Scheduler*>(data)->pull_audio(out, frames);
+   }
+
+   // Runs on the device's thread. Hands out whole frames only, the device fills up with silence if we run dry.
+   size_t Scheduler::pull_audio(int16_t *out, size_t frames)
+   {
+      // The device starts a new thread after every pause and seek.
+      static thread_local bool set_up = false;
+      if (!set_up)
+      {
+         General::setup_thread("audio output", opts.threads.audio);
+         set_up = true;
+      }
+
+      unsigned channels = out_channels;
+      size_t avail = pcm_ring.read_avail() / channels;
+      size_t got = pcm_ring.read(out, std::min(avail, frames) * channels) / channels;
+      pcm_cond.signal();
+
+      // Not counting the start, or the end of the stream.
+      if (got < frames && audio_samples > 0 && aud_pkt_queue.alive() && !is_paused)
+      {
+         audio_underruns++;
+         General::Tracer::get().instant("audio underrun");
+      }
+      return got;
+   }
+
+   // Called from the audio thread after a seek. Throws away everything decoded from the old position.
+   void Scheduler::flush_audio()
+   {
+      audio_lock.lock();
+      avcodec_flush_buffers(file->audio().ctx);
+      audio_lock.unlock();
+      resampler.reset(out_channels);
+      converter.clear();
+
+      // Stops the device's thread, so the ring can be emptied from here.
+      audio->pause();
+      pcm_ring.reset(pcm_ring.capacity());
+      audio->unpause();
+   }
+
+   // Called from the audio thread. Stops the device until we're unpaused.
+   void Scheduler::wait_unpaused()
+   {
+      audio->pause();
+      pause_cond.wait_until([this]() {
+            return !is_paused || !audio_thread_active;
+         });
+      audio->unpause();
    }
 
    void Scheduler::process_subtitle(Display::Ptr vid)
@@ -346,17 +806,9 @@ namespace AV
       vid->get_rect(disp_x, disp_y);
       sub_renderer->set_dimensions(disp_x, disp_y);
 
-      for (;;)
+      Packet packet;
+      while (sub_pkt_queue.pull(packet))
       {
-         avlock.lock();
-         if (sub_pkt_queue.size() == 0)
-         {
-            avlock.unlock();
-            break;
-         }
-         auto packet = sub_pkt_queue.pull();
-         avlock.unlock();
-
          auto& pkt = packet.get();
 
          uint8_t *data = pkt.data;
@@ -418,62 +870,122 @@ namespace AV
 
    void Scheduler::add_event_handler(EventHandler::Ptr handler)
    {
-      std::lock_guard<std::mutex> f(avlock);
+      std::lock_guard<General::TimedMutex> f(avlock);
+      handler->attach(control_loop);
       event_handlers.push_back(handler);
    }
 
    void Scheduler::add_info_handler(IO::InfoOutput::Ptr handler)
    {
-      std::lock_guard<std::mutex> f(avlock);
+      std::lock_guard<General::TimedMutex> f(avlock);
       info_handlers.push_back(handler);
    }
 
-   // Video thread
+   // Uploads a frame, hands it back to the decoder, and draws subtitles on top.
+   void Scheduler::present(Display::Ptr vid, FrameQueue::Frame& out)
+   {
+      // The texture upload copies, so the decoder can have the frame back right away.
+      const uint8_t *planes[3] = { &out.planes[0][0], &out.planes[1][0], &out.planes[2][0] };
+      {
+         General::StageTimer t(upload_stage, "upload");
+         vid->frame(planes, out.linesize, out.width, out.height);
+      }
+      frame_queue.pop();
+
+      if (file->sub().active)
+      {
+         General::StageTimer t(subtitle_stage, "subtitles");
+         process_subtitle(vid);
+      }
+   }
+
+   // Video thread. Owns the GL context, and only uploads and presents what the decoder thread queued up.
    void Scheduler::video_thread_fn()
    {
-      auto vid = GL::shared(file->video().width, file->video().height, file->video().aspect_ratio, file->video().ctx->pix_fmt);
+      General::setup_thread("video", opts.threads.video);
+      Display::Ptr vid;
+      EventHandler::Ptr event;
+      if (opts.benchmark && !opts.benchmark_present)
+         vid = Video::Null::shared(file->video().width, file->video().height);
+      else
+      {
+         vid = GL::shared(file->video().width, file->video().height, file->video().aspect_ratio, file->video().ctx->pix_fmt);
+         event = GLEvent::shared();
+      }
       video = vid;
-      auto event = GLEvent::shared();
 
       if (file->sub().active)
          sub_renderer = ASSRenderer::shared(file->sub().fonts, file->sub().ass_data, file->video().width, file->video().height);
 
-      AVFrame *frame = avcodec_alloc_frame();
-
       // Add event handler for GL.
-      add_event_handler(event);
+      if (event)
+         add_event_handler(event);
+
+      unsigned shown_serial = 0;
 
-      while (video_thread_active && vid_pkt_queue.alive())
+      while (video_thread_active && frame_queue.alive())
       {
-         event->poll(); 
-         avlock.lock();
-         if (vid_pkt_queue.size() > 0 && !is_paused)
+         if (event)
+            event->poll(); 
+         FrameQueue::Frame *out = is_paused ? nullptr : frame_queue.front();
+         if (out)
          {
-            auto pkt = vid_pkt_queue.pull();
-            avlock.unlock();
-            process_video(pkt.get(), vid, frame);
+            // Decoded before a seek, throw it away.
+            if (out->serial != vid_pkt_queue.current_serial())
+            {
+               frame_queue.pop();
+               continue;
+            }
 
-            if (file->sub().active)
-               process_subtitle(vid);
+            // First frame after a seek, subtitles we have lying around are from the old position.
+            if (out->serial != shown_serial)
+            {
+               gfx_lock.lock();
+               if (file->sub().active)
+                  avcodec_flush_buffers(file->sub().ctx);
+               if (sub_renderer.get() != nullptr)
+                  sub_renderer->flush();
+               gfx_lock.unlock();
+               shown_serial = out->serial;
+            }
 
-            // We have to calculate how long we should wait before swapping frame to screen.
-            // We sync everything to audio clock.
-            double delta = get_time();
+            video_pts = out->pts;
+
+            // Everything goes on screen as soon as we have it.
+            if (opts.benchmark)
+            {
+               present(vid, *out);
+               General::StageTimer t(flip_stage, "flip");
+               vid->flip();
+               continue;
+            }
 
-            avlock.lock();
-            delta -= audio_pts_ts;
-            double sleep_time = video_pts - (audio_pts + delta);
-            avlock.unlock();
+            start_clock(video_pts);
 
-            // Yes, it can happen! :(
-            if (delta < 0.0)
-               delta = 0.0;
-            //std::cout << "Delta: " << delta << std::endl;
+            // When video is the master, it can't be late by definition.
+            Clock& master = master_clock();
+            double late = 0.0;
+            if (&master != &video_clock)
+               late = master.get() - video_pts;
+            update_skip_level(late);
 
-            if (video_pts > (audio_pts + delta) && audio_thread_active)
+            // Already too late to show, and the next one is ready, so don't bother uploading this one.
+            if (late > frame_time() && frame_queue.size() > 1)
             {
-               double last_frame_delta = get_time();
-               last_frame_delta -= video_pts_ts;
+               frame_queue.pop();
+               frames_dropped++;
+               continue;
+            }
+
+            present(vid, *out);
+
+            // We have to calculate how long we should wait before swapping frame to screen.
+            // With video as the master, this just keeps frames a frame time apart.
+            double sleep_time = video_pts - master.get();
+
+            if (sleep_time > 0.0)
+            {
+               double last_frame_delta = video_clock.age();
 
                // :(
                if (last_frame_delta < 0.0)
@@ -491,73 +1003,319 @@ namespace AV
                   sleep_time = max_sleep;
                }
                //std::cout << "Sleep for " << sleep_time << std::endl;
-               sync_sleep(sleep_time);
+               General::TraceScope t("sleep");
+               frame_timer.sleep(sleep_time);
             }
 
-            video_pts_ts = get_time();
+            video_clock.reset(video_pts);
+            General::StageTimer t(flip_stage, "flip");
             vid->flip();
          }
+         else if (is_paused)
+         {
+            // SDL can't tell us when there's input, so we still have to come around and pump its events now and then.
+            pause_cond.wait_for([this]() {
+                  return !is_paused || !video_thread_active;
+               }, 0.05);
+         }
          else
          {
-            avlock.unlock();
+            frame_queue.wait_until([this]() {
+                  return frame_queue.size() > 0 || !frame_queue.alive() || !video_thread_active;
+               });
+         }
+      }
+      video_thread_active = false;
+
+      // The decoder might be waiting for us to make room.
+      frame_queue.signal();
+      control_loop.notify();
+   }
+
+   // If we keep presenting late, have the decoder skip work, one step at a time. Back off again when we've been on time for a while.
+   void Scheduler::update_skip_level(double late)
+   {
+      static const unsigned max_level = 3;
+      static const unsigned late_threshold = 8;
+      static const unsigned on_time_threshold = 120;
+
+      if (late > frame_time())
+      {
+         on_time_frames = 0;
+         if (++late_frames >= late_threshold && skip_level < max_level)
+         {
+            skip_level++;
+            late_frames = 0;
+         }
+      }
+      else if (late < 0.5 * frame_time())
+      {
+         late_frames = 0;
+         if (++on_time_frames >= on_time_threshold && skip_level > 0)
+         {
+            skip_level--;
+            on_time_frames = 0;
+         }
+      }
+   }
+
+   // Keeps the audio clock locked to the master by playing audio a tiny bit faster or slower, instead of letting it drift away.
+   // Nobody hears a few tenths of a percent.
+   void Scheduler::update_drift_correction()
+   {
+      static const double max_correction = 0.005;
+      // Correction per second of error.
+      static const double gain = 0.05;
+      // How quickly the measured clock drift is folded into the long term correction.
+      static const double drift_gain = 0.01;
+      static const double smoothing = 0.1;
+
+      double error = audio_clock.get() - master_clock().get();
+
+      // A device running off its nominal rate shows up as steady drift against the system clock. Learning that
+      // separately gets rid of the constant offset a purely proportional correction would settle at.
+      drift_ratio += audio_clock.drift() * drift_gain;
+      drift_ratio = std::max(std::min(drift_ratio, max_correction), -max_correction);
+
+      // Anything this far off is a seek or a stall, not drift.
+      double target = 0.0;
+      if (std::fabs(error) < 1.0)
+         target = std::max(std::min(drift_ratio + error * gain, max_correction), -max_correction);
+
+      double ratio = resampler.get_ratio();
+      resampler.set_ratio(ratio + (1.0 + target - ratio) * smoothing);
+   }
 
-            if (is_paused)
-               sync_sleep(0.01);
-            else
+   // Video decoder thread
+   void Scheduler::video_decode_thread_fn()
+   {
+      General::setup_thread("video decode", opts.threads.decode);
+      AVFrame *frame = avcodec_alloc_frame();
+
+      unsigned caught_up_serial = 0;
+      unsigned flushed_serial = 0;
+
+      while (video_thread_active && !vid_pkt_queue.finished())
+      {
+         Packet pkt;
+         unsigned serial = 0;
+         if (vid_pkt_queue.pull(pkt, &serial))
+         {
+            // First packet after a seek, whatever the decoder holds on to is from the old position.
+            if (serial != flushed_serial)
             {
-               // Having some race conditions... quickfix it for now.
-               vid_pkt_queue.wait();
-               //sync_sleep(0.01);
-               //vid_pkt_queue.signal();
+               avcodec_flush_buffers(file->video().ctx);
+               decoder_pending = 0;
+               flushed_serial = serial;
             }
+
+            double hide_before = -1.0;
+            if (serial == video_seek_serial && serial != caught_up_serial)
+               hide_before = seek_target;
+
+            if (process_video(pkt.get(), frame, serial, hide_before))
+               caught_up_serial = serial;
+         }
+         else
+         {
+            General::TraceScope t("wait packets");
+            vid_pkt_queue.wait_until([this]() {
+                  return vid_pkt_queue.size() > 0 || !vid_pkt_queue.alive() || !video_thread_active;
+               });
          }
       }
-      video_thread_active = false;
+
+      // Nothing more is coming, get the last pictures out of the decoder and let the presenter run dry.
+      if (video_thread_active && flushed_serial == vid_pkt_queue.current_serial())
+      {
+         double hide_before = -1.0;
+         if (flushed_serial == video_seek_serial && flushed_serial != caught_up_serial)
+            hide_before = seek_target;
+         drain_video(frame, flushed_serial, hide_before);
+      }
+      frame_queue.finalize();
       av_free(frame);
    }
 
+   // Demuxer thread
+   void Scheduler::demux_thread_fn()
+   {
+      General::setup_thread("demux", opts.threads.demux);
+      while (demux_thread_active)
+      {
+         Packet pkt;
+
+         // Grab the serial before looking for seeks, so a request coming in after this makes us drop the packet.
+         // A seek we carry out may have been requested after that, so take its serial instead.
+         unsigned serial = seek_serial;
+         if (seek_pending)
+            serial = perform_seek();
+
+         Packet::Type type;
+         {
+            General::StageTimer t(demux_stage, "demux");
+            type = file->packet(pkt);
+         }
+
+         PacketQueue *queue = nullptr;
+
+         switch (type)
+         {
+            case Packet::Type::Error:
+               // Signal to threads that there won't be any more data, but stay around in case we get to seek back.
+               demux_eof = true;
+               aud_pkt_queue.finalize();
+               vid_pkt_queue.finalize();
+               sub_pkt_queue.finalize();
+               control_loop.notify();
+               demux_cond.wait_until([this]() {
+                     return seek_pending || !demux_thread_active;
+                  });
+               continue;
+
+            case Packet::Type::None:
+               continue;
+
+            case Packet::Type::Audio:
+               queue = &aud_pkt_queue;
+               break;
+
+            case Packet::Type::Video:
+               queue = &vid_pkt_queue;
+               break;
+
+            case Packet::Type::Subtitle:
+               // Subtitles are shown by the video thread, without it nobody would ever take them out.
+               if (!video_thread_active)
+                  continue;
+               queue = &sub_pkt_queue;
+               break;
+
+            default:
+               throw std::runtime_error("What kind of package is this? o.o\n");
+         }
+
+         {
+            General::TraceScope t("queues full");
+            demux_cond.wait_until([this, type]() {
+                  return !demux_thread_active || seek_pending || !queues_full(type);
+               });
+         }
+
+         // If we seeked while waiting, this packet is stale, so just drop it.
+         std::lock_guard<std::mutex> f(demux_lock);
+         if (serial == seek_serial && !queue->push(std::move(pkt)))
+         {
+            // Either the decoder is gone, or a subtitle queue nobody drains ran over.
+            packets_dropped++;
+            General::Tracer::get().instant("packet dropped");
+         }
+
+         auto& tracer = General::Tracer::get();
+         if (tracer.enabled())
+         {
+            tracer.counter("audio queue (s)", aud_pkt_queue.duration());
+            tracer.counter("video queue (s)", vid_pkt_queue.duration());
+         }
+      }
+   }
+
    // Audio thread
    void Scheduler::audio_thread_fn()
    {
+      General::setup_thread("audio", opts.threads.audio);
       try
       {
-         audio = ALSA<int16_t>::shared(file->audio().channels, file->audio().rate);
+         if (opts.benchmark)
+            audio = Audio::Null<int16_t>::shared(file->audio().channels, file->audio().rate, false);
+         else
+            audio = ALSA<int16_t>::shared(file->audio().channels, file->audio().rate, opts.audio_device);
       } 
       catch (std::exception& e) 
       {
          std::cerr << e.what() << std::endl;
-         audio = Null<int16_t>::shared(file->audio().channels, file->audio().rate);
+         audio = Audio::Null<int16_t>::shared(file->audio().channels, file->audio().rate);
+
+         // The null backend only sleeps, so it's no good as a clock.
+         Sync expected = Sync::Audio;
+         sync_mode.compare_exchange_strong(expected, Sync::External);
       }
 
+      // The device might not do the stream's rate or channel count, and the decoder may not hand out s16.
+      out_rate = audio->rate();
+      out_channels = audio->channels();
+      decoded_format = Internal::sample_format(file->audio().ctx->sample_fmt);
+      converter.reset(decoded_format, file->audio().channels, file->audio().rate, out_channels, out_rate);
+
       AlignedBuffer<int16_t> audio_buffer(AVCODEC_MAX_AUDIO_FRAME_SIZE);
+      resampler.reset(out_channels);
+      pcm_ring.reset(std::max<size_t>(opts.audio_buffer * out_rate, 1) * out_channels);
+      auto& budget = General::MemoryBudget::get().component("audio buffer");
+      budget.add((audio_buffer.size() + pcm_ring.capacity()) * sizeof(int16_t));
+
+      // From here on the device pulls from pcm_ring on its own thread, and we only decode.
+      audio->set_audio_callback(&Scheduler::audio_callback, this);
 
-      while (audio_thread_active && aud_pkt_queue.alive())
+      unsigned caught_up_serial = 0;
+      unsigned flushed_serial = 0;
+
+      while (audio_thread_active && !aud_pkt_queue.finished())
       {
          if (is_paused)
-         {
-            audio->pause();
-            while (is_paused)
-               sync_sleep(0.01);
+            wait_unpaused();
 
-            audio->unpause();
+         // Don't wait for the first packet from the new position, the device would keep playing the old one until then.
+         unsigned current = aud_pkt_queue.current_serial();
+         if (current != flushed_serial)
+         {
+            flush_audio();
+            flushed_serial = current;
          }
 
-         avlock.lock();
-         if (aud_pkt_queue.size() > 0)
+         Packet pkt;
+         unsigned serial = 0;
+         if (aud_pkt_queue.pull(pkt, &serial))
          {
-            auto pkt = aud_pkt_queue.pull();
-            avlock.unlock();
-            process_audio(pkt.get(), audio_buffer);
+            if (serial != flushed_serial)
+            {
+               flush_audio();
+               flushed_serial = serial;
+            }
+
+            double trim_before = -1.0;
+            if (serial == audio_seek_serial && serial != caught_up_serial)
+               trim_before = seek_target;
+
+            if (process_audio(pkt.get(), audio_buffer, serial, trim_before))
+               caught_up_serial = serial;
          }
          else
          {
-            avlock.unlock();
-            // Having some race conditions, quickfix it for now...
-            aud_pkt_queue.wait();
-            //sync_sleep(0.01);
-            //aud_pkt_queue.signal();
+            General::TraceScope t("wait packets");
+            aud_pkt_queue.wait_until([this, flushed_serial]() {
+                  return aud_pkt_queue.size() > 0 || !aud_pkt_queue.alive() || !audio_thread_active ||
+                     aud_pkt_queue.current_serial() != flushed_serial;
+               });
          }
       }
+
+      // Let the device play out what's left before going quiet.
+      while (pcm_ring.read_avail() > 0 && audio_thread_active && audio->alive())
+      {
+         if (is_paused)
+         {
+            wait_unpaused();
+            continue;
+         }
+
+         pcm_cond.wait_for([this]() {
+               return pcm_ring.read_avail() == 0 || is_paused || !audio_thread_active || !audio->alive();
+            }, Internal::device_poll);
+      }
+      audio->set_audio_callback(nullptr);
+
+      budget.sub((audio_buffer.size() + pcm_ring.capacity()) * sizeof(int16_t));
       audio_thread_active = false;
+      control_loop.notify();
    }
 }
@@ -21,7 +21,14 @@
 #define __SCHEDULER_HPP
 
 #include "AV.hpp"
+#include "Clock.hpp"
+#include "Timer.hpp"
+#include "Stats.hpp"
+#include "Thread.hpp"
+#include "audio/resampler.hpp"
+#include "audio/convert.hpp"
 #include "term/InfoOutput.hpp"
+#include <ostream>
 
 namespace AV
 {
@@ -29,7 +36,51 @@ namespace AV
    {
       public:
          DECL_SMART(Scheduler);
-         Scheduler(FF::MediaFile::Ptr in_file);
+
+         // Which clock everyone else follows.
+         enum class Sync
+         {
+            Audio,
+            Video,
+            // The system clock. Used whenever the chosen stream is missing, or audio goes to the null backend.
+            External
+         };
+
+         struct Options
+         {
+            Options();
+            PacketQueue::Limits video_limits;
+            PacketQueue::Limits audio_limits;
+            PacketQueue::Limits sub_limits;
+            // How many decoded pictures the video decoder may run ahead of presentation.
+            unsigned decoded_frames;
+            // Decode up to the exact seek target instead of showing whatever comes after the keyframe.
+            bool accurate_seek;
+            Sync sync;
+            // Resample audio by fractions of a percent to stay locked to the master clock, when that's not audio itself.
+            bool drift_correction;
+            // How many seconds of decoded audio may queue up in front of the output device.
+            double audio_buffer;
+            Audio::DeviceOptions audio_device;
+            // Scheduling for each of our threads. The audio policy covers the device's callback thread as well.
+            struct Threads
+            {
+               General::ThreadPolicy control;
+               General::ThreadPolicy demux;
+               General::ThreadPolicy video;
+               General::ThreadPolicy decode;
+               General::ThreadPolicy audio;
+            } threads;
+            // mlockall() everything, so audio never stalls on a page fault.
+            bool lock_memory;
+            // How long before a frame's deadline the video thread stops sleeping and starts spinning.
+            double timer_slack;
+            // Run everything as fast as it goes, into null audio and video sinks unless benchmark_present is set.
+            bool benchmark;
+            bool benchmark_present;
+         };
+
+         Scheduler(FF::MediaFile::Ptr in_file, const Options& opts = Options());
          void operator=(const Scheduler&) = delete;
          Scheduler(const Scheduler&) = delete;
 
@@ -42,50 +93,141 @@ namespace AV
          void run();
          static void sync_sleep(float time);
 
+         // Writes throughput and time spent in each stage as JSON.
+         void report(std::ostream& out);
+
       private:
          FF::MediaFile::Ptr file;
+         Options opts;
          bool has_video;
          bool has_audio;
          volatile bool is_active;
+         // Timestamp of the picture on screen.
          double video_pts;
-         double audio_pts;
-         double audio_pts_ts;
-         double video_pts_ts;
          size_t audio_written;
+
+         Clock audio_clock;
+         Clock video_clock;
+         Clock external_clock;
+         std::atomic<Sync> sync_mode;
+         std::atomic<bool> clock_started;
+         Clock& master_clock();
+         void start_clock(double pts);
          volatile bool is_paused;
-         std::mutex avlock;
-         std::mutex audio_lock;
-         std::mutex gfx_lock;
+
+         // Seeks are requested from the control thread and carried out by the demuxer.
+         // Requests that come in before the demuxer gets around to it are merged into one.
+         std::mutex seek_lock;
+         std::atomic<bool> seek_pending;
+         double pending_target;
+         std::atomic<unsigned> seek_serial;
+
+         // Packets with these queue serials are decoded but not presented until seek_target is reached.
+         std::atomic<unsigned> video_seek_serial;
+         std::atomic<unsigned> audio_seek_serial;
+         volatile double seek_target;
+         // Timestamp of the last decoded picture, only touched by the video decoder thread.
+         double decode_pts;
+         // Packets the video decoder took in without a picture coming out yet.
+         unsigned decoder_pending;
+
+         // The presenter decides how much work the decoder may skip, depending on how late frames are.
+         std::atomic<unsigned> skip_level;
+         unsigned late_frames;
+         unsigned on_time_frames;
+         std::atomic<unsigned> frames_dropped;
+         std::atomic<unsigned> frames_skipped;
+         General::TimedMutex avlock;
+         std::mutex demux_lock;
+         General::TimedMutex audio_lock;
+         General::TimedMutex gfx_lock;
 
          std::list<EventHandler::Ptr> event_handlers;
          std::list<IO::InfoOutput::Ptr> info_handlers;
          EventHandler::Event next_event();
 
+         volatile bool demux_thread_active;
+         // Set while the demuxer sits at the end of the file, waiting for a seek or for us to go down.
+         std::atomic<bool> demux_eof;
          volatile bool video_thread_active;
          volatile bool audio_thread_active;
          PacketQueue vid_pkt_queue;
          PacketQueue aud_pkt_queue;
          PacketQueue sub_pkt_queue;
+         FrameQueue frame_queue;
+         General::PrecisionTimer frame_timer;
+
+         General::Stage demux_stage;
+         General::Stage video_decode_stage;
+         General::Stage frame_copy_stage;
+         General::Stage upload_stage;
+         General::Stage subtitle_stage;
+         General::Stage flip_stage;
+         General::Stage audio_decode_stage;
+         General::Stage audio_convert_stage;
+         General::Stage audio_output_stage;
+         std::atomic<uint64_t> audio_samples;
+         std::atomic<uint64_t> audio_underruns;
+         // Packets the demuxer read but had nowhere to put.
+         std::atomic<uint64_t> packets_dropped;
+         double start_time;
+         General::ProducerConsumer demux_cond;
+         // Signalled whenever we pause or unpause.
+         General::ProducerConsumer pause_cond;
+         // The thread in run() sleeps here.
+         General::EventLoop control_loop;
          AV::Sub::Renderer::Ptr sub_renderer;
 
+         std::thread demux_thread;
          std::thread video_thread;
+         std::thread video_decode_thread;
          std::thread audio_thread;
          Video::Display::Ptr video;
+         // Decoded audio on its way to the device. The audio thread fills it, and the device's callback drains it.
+         General::SampleRing<int16_t> pcm_ring;
+         // Signalled when the device took something out of pcm_ring.
+         General::ProducerConsumer pcm_cond;
          Audio::Stream<int16_t>::Ptr audio;
-
-         void perform_seek(double delta);
+         Audio::DriftResampler<int16_t> resampler;
+         std::vector<int16_t> resampled;
+         // Decoded audio is turned into whatever the device settled on.
+         Audio::SampleFormat decoded_format;
+         Audio::Converter converter;
+         std::vector<int16_t> converted;
+         std::atomic<unsigned> out_rate;
+         std::atomic<unsigned> out_channels;
+         // Long term speed correction learned from the audio clock's drift against the system clock.
+         double drift_ratio;
+
+         void request_seek(double delta);
+         unsigned perform_seek();
 
          void process_subtitle(AV::Video::Display::Ptr);
-         void process_video(AVPacket&, AV::Video::Display::Ptr, AVFrame*);
-         void process_audio(AVPacket&, AlignedBuffer<int16_t>&);
+         void present(AV::Video::Display::Ptr, FrameQueue::Frame&);
+         bool process_video(AVPacket&, AVFrame*, unsigned serial, double hide_before);
+         bool queue_frame(AVFrame*, unsigned serial, double hide_before);
+         void drain_video(AVFrame*, unsigned serial, double hide_before);
+         bool process_audio(AVPacket&, AlignedBuffer<int16_t>&, unsigned serial, double trim_before);
+         void queue_audio(const int16_t *samples, size_t count, unsigned serial);
+         static ssize_t audio_callback(int16_t *out, size_t frames, void *data);
+         size_t pull_audio(int16_t *out, size_t frames);
+         void flush_audio();
+         void wait_unpaused();
          void pause_toggle();
+         void set_paused(bool paused);
+         void update_drift_correction();
+         void update_skip_level(double late);
+
+         bool queues_full(FF::Packet::Type type) const;
 
+         void demux_thread_fn();
          void video_thread_fn();
+         void video_decode_thread_fn();
          void audio_thread_fn();
 
          double frame_time() const;
-         static double get_time();
          void show_info();
+         std::vector<std::pair<const char*, const General::Stage*>> stages() const;
    };
 }
 
@@ -0,0 +1,185 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __STATS_HPP
+#define __STATS_HPP
+
+#include "Timer.hpp"
+#include "Trace.hpp"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+namespace General
+{
+   // Log-linear histogram of nanosecond values, in the spirit of HdrHistogram. Every power of two is split into 16 buckets,
+   // so anything we report is within about 6% of the real value. record() is lock-free and can be called from any thread.
+   class Histogram
+   {
+      public:
+         Histogram()
+         {
+            for (auto& bucket : buckets)
+               bucket = 0;
+         }
+
+         void operator=(const Histogram&) = delete;
+         Histogram(const Histogram&) = delete;
+
+         void record(uint64_t value)
+         {
+            buckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+         }
+
+         // Returns the upper end of the bucket holding the p-th fraction of recorded values, p in [0, 1].
+         uint64_t percentile(double p) const
+         {
+            uint64_t total = 0;
+            for (auto& bucket : buckets)
+               total += bucket.load(std::memory_order_relaxed);
+            if (total == 0)
+               return 0;
+
+            uint64_t target = (uint64_t)(p * total);
+            if (target < 1)
+               target = 1;
+
+            uint64_t seen = 0;
+            for (unsigned i = 0; i < num_buckets; i++)
+            {
+               seen += buckets[i].load(std::memory_order_relaxed);
+               if (seen >= target)
+                  return upper(i);
+            }
+            return upper(num_buckets - 1);
+         }
+
+      private:
+         static const unsigned sub_bits = 4;
+         static const unsigned sub_count = 1 << sub_bits;
+         static const unsigned num_buckets = (65 - sub_bits) * sub_count;
+         std::atomic<uint64_t> buckets[num_buckets];
+
+         static unsigned index(uint64_t value)
+         {
+            if (value < 2 * sub_count)
+               return value;
+
+            unsigned exp = 63 - __builtin_clzll(value);
+            unsigned shift = exp - sub_bits;
+            return (exp - sub_bits) * sub_count + (value >> shift);
+         }
+
+         static uint64_t upper(unsigned index)
+         {
+            if (index < 2 * sub_count)
+               return index;
+
+            unsigned exp = index / sub_count + sub_bits - 1;
+            unsigned shift = exp - sub_bits;
+            uint64_t sub = index % sub_count + sub_count;
+            return ((sub + 1) << shift) - 1;
+         }
+   };
+
+   // Total time and number of runs of one step in the pipeline, and how the run times are spread out.
+   // Can be updated from any thread.
+   class Stage
+   {
+      public:
+         Stage() : total_ns(0), runs(0) {}
+         void operator=(const Stage&) = delete;
+         Stage(const Stage&) = delete;
+
+         void add(double secs)
+         {
+            uint64_t ns = secs > 0.0 ? (uint64_t)(secs * 1000000000) : 0;
+            total_ns += ns;
+            runs++;
+            hist.record(ns);
+         }
+
+         double total() const { return total_ns * 0.000000001; }
+         uint64_t count() const { return runs; }
+         double mean() const { return runs ? total() / runs : 0.0; }
+         // In seconds, p in [0, 1].
+         double percentile(double p) const { return hist.percentile(p) * 0.000000001; }
+
+      private:
+         std::atomic<uint64_t> total_ns;
+         std::atomic<uint64_t> runs;
+         Histogram hist;
+   };
+
+   // Adds the time until it goes out of scope to a Stage, and to the trace if one is being recorded.
+   class StageTimer
+   {
+      public:
+         StageTimer(Stage& in_stage, const char *in_name) : stage(in_stage), name(in_name), start(PrecisionTimer::now()) {}
+         ~StageTimer()
+         {
+            double end = PrecisionTimer::now();
+            stage.add(end - start);
+            Tracer::get().complete(name, start, end);
+         }
+
+         void operator=(const StageTimer&) = delete;
+         StageTimer(const StageTimer&) = delete;
+
+      private:
+         Stage& stage;
+         const char *name;
+         double start;
+   };
+
+   // Drop-in for std::mutex that keeps track of how long lockers had to wait.
+   class TimedMutex
+   {
+      public:
+         TimedMutex() {}
+         void operator=(const TimedMutex&) = delete;
+         TimedMutex(const TimedMutex&) = delete;
+
+         void lock()
+         {
+            if (mutex.try_lock())
+            {
+               wait_stage.add(0.0);
+               return;
+            }
+
+            double start = PrecisionTimer::now();
+            mutex.lock();
+            double end = PrecisionTimer::now();
+            wait_stage.add(end - start);
+            Tracer::get().complete("lock wait", start, end);
+         }
+
+         bool try_lock() { return mutex.try_lock(); }
+         void unlock() { mutex.unlock(); }
+
+         const Stage& waits() const { return wait_stage; }
+
+      private:
+         std::mutex mutex;
+         Stage wait_stage;
+   };
+}
+
+#endif
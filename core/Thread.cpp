@@ -0,0 +1,166 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Thread.hpp"
+#include "General.hpp"
+#include "Trace.hpp"
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+namespace General
+{
+   namespace Internal
+   {
+      static int parse_int(const std::string& str, const std::string& spec)
+      {
+         char *end = nullptr;
+         long val = strtol(str.c_str(), &end, 0);
+         if (str.empty() || *end != '\0')
+            throw std::runtime_error(General::join("Invalid number \"", str, "\" in thread policy \"", spec, "\".\n"));
+         return val;
+      }
+
+      // "0+2-3" -> 0, 2, 3
+      static std::vector<unsigned> parse_cpus(const std::string& str, const std::string& spec)
+      {
+         std::vector<unsigned> cpus;
+         std::istringstream stream(str);
+         std::string range;
+         while (std::getline(stream, range, '+'))
+         {
+            size_t dash = range.find('-');
+            int first = parse_int(range.substr(0, dash), spec);
+            int last = dash == std::string::npos ? first : parse_int(range.substr(dash + 1), spec);
+            if (first < 0 || last < first || last >= CPU_SETSIZE)
+               throw std::runtime_error(General::join("Invalid CPU range \"", range, "\" in thread policy \"", spec, "\".\n"));
+
+            for (int cpu = first; cpu <= last; cpu++)
+               cpus.push_back(cpu);
+         }
+         return cpus;
+      }
+   }
+
+   ThreadPolicy ThreadPolicy::parse(const std::string& spec)
+   {
+      ThreadPolicy policy;
+      std::istringstream stream(spec);
+      std::string item;
+      while (std::getline(stream, item, ','))
+      {
+         size_t colon = item.find(':');
+         std::string key = item.substr(0, std::min(colon, item.find('=')));
+
+         if (key == "fifo" || key == "rr")
+         {
+            policy.sched = key == "fifo" ? Class::FIFO : Class::RR;
+            policy.priority = colon == std::string::npos ? 50 : Internal::parse_int(item.substr(colon + 1), spec);
+            if (policy.priority < 1 || policy.priority > 99)
+               throw std::runtime_error(General::join("Real-time priority has to be 1 - 99 in thread policy \"", spec, "\".\n"));
+         }
+         else if (key == "normal")
+            policy.sched = Class::Normal;
+         else if (key == "nice" && key.size() < item.size())
+         {
+            policy.nice = Internal::parse_int(item.substr(key.size() + 1), spec);
+            policy.set_nice = true;
+         }
+         else if (key == "cpus" && key.size() < item.size())
+            policy.cpus = Internal::parse_cpus(item.substr(key.size() + 1), spec);
+         else
+            throw std::runtime_error(General::join("Don't know what \"", item, "\" means in thread policy \"", spec, "\".\n"));
+      }
+      return policy;
+   }
+
+   void setup_thread(const char *name, const ThreadPolicy& policy)
+   {
+      // The kernel only keeps 15 characters. Renaming the main thread would rename the whole process in ps.
+      pid_t tid = syscall(SYS_gettid);
+      if (tid != getpid())
+      {
+         char short_name[16];
+         strncpy(short_name, name, sizeof(short_name) - 1);
+         short_name[sizeof(short_name) - 1] = '\0';
+         pthread_setname_np(pthread_self(), short_name);
+      }
+      Tracer::get().name_thread(name);
+
+      if (!policy.cpus.empty())
+      {
+         cpu_set_t set;
+         CPU_ZERO(&set);
+         for (auto cpu : policy.cpus)
+            CPU_SET(cpu, &set);
+
+         int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+         if (rc != 0)
+            std::cerr << "Can't pin " << name << " thread to its CPUs: " << strerror(rc) << std::endl;
+      }
+
+      bool fall_back = false;
+      if (policy.sched != ThreadPolicy::Class::Normal)
+      {
+         struct sched_param param;
+         memset(&param, 0, sizeof(param));
+         param.sched_priority = policy.priority;
+         int rc = pthread_setschedparam(pthread_self(), policy.sched == ThreadPolicy::Class::FIFO ? SCHED_FIFO : SCHED_RR, &param);
+         if (rc != 0)
+         {
+            std::cerr << "Can't use real-time scheduling for " << name << " thread (" << strerror(rc) << "), using niceness instead." << std::endl;
+            fall_back = true;
+         }
+      }
+
+      // Niceness is per thread on Linux. Without an explicit value, real-time threads that didn't get it get the most we're allowed.
+      int nice = policy.nice;
+      if (fall_back && !policy.set_nice)
+      {
+         struct rlimit limit;
+         nice = getrlimit(RLIMIT_NICE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY ? 20 - (int)limit.rlim_cur : -20;
+         nice = std::min(nice, 0);
+      }
+
+      if ((policy.set_nice || fall_back) && nice != 0)
+      {
+         if (setpriority(PRIO_PROCESS, tid, nice) < 0)
+            std::cerr << "Can't set niceness of " << name << " thread to " << nice << ": " << strerror(errno) << std::endl;
+      }
+   }
+
+   bool lock_memory()
+   {
+      if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+      {
+         std::cerr << "Can't lock memory: " << strerror(errno) << std::endl;
+         return false;
+      }
+      return true;
+   }
+}
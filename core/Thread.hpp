@@ -0,0 +1,60 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __THREAD_HPP
+#define __THREAD_HPP
+
+#include <string>
+#include <vector>
+
+namespace General
+{
+   // How the OS should schedule one of our threads. The defaults leave everything as it is.
+   struct ThreadPolicy
+   {
+      enum class Class
+      {
+         Normal,
+         FIFO,
+         RR
+      };
+
+      ThreadPolicy() : sched(Class::Normal), priority(0), nice(0), set_nice(false) {}
+
+      // Parses e.g. "fifo:70,nice=-5,cpus=0+2-3" and throws std::runtime_error if that doesn't work out.
+      static ThreadPolicy parse(const std::string& spec);
+
+      Class sched;
+      // Real-time priority, 1 - 99.
+      int priority;
+      int nice;
+      bool set_nice;
+      // Empty for any CPU.
+      std::vector<unsigned> cpus;
+   };
+
+   // Names the calling thread for the OS and the tracer, and applies the policy to it.
+   // If real-time scheduling isn't allowed, it says so and falls back to niceness.
+   void setup_thread(const char *name, const ThreadPolicy& policy);
+
+   // Keeps all our memory resident, so the audio path never waits for a page fault. Returns false if not allowed.
+   bool lock_memory();
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Timer.hpp"
+#include <thread>
+#include <time.h>
+#include <errno.h>
+
+namespace General
+{
+   namespace Internal
+   {
+      static int64_t now_ns()
+      {
+         struct timespec ts;
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+         return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+      }
+
+      // Close to the deadline, even a yield can take too long to come back.
+      static const int64_t yield_threshold_ns = 200000;
+   }
+
+   PrecisionTimer::PrecisionTimer(double in_slack) : slack_ns(0), waits(0), total_error_ns(0), max_error_ns(0), oversleeps(0)
+   {
+      set_slack(in_slack);
+   }
+
+   void PrecisionTimer::set_slack(double secs)
+   {
+      slack_ns = secs > 0.0 ? (int64_t)(secs * 1000000000) : 0;
+   }
+
+   double PrecisionTimer::slack() const
+   {
+      return slack_ns * 0.000000001;
+   }
+
+   double PrecisionTimer::now()
+   {
+      return Internal::now_ns() * 0.000000001;
+   }
+
+   void PrecisionTimer::sleep(double secs)
+   {
+      sleep_until(now() + secs);
+   }
+
+   void PrecisionTimer::sleep_until(double deadline_secs)
+   {
+      int64_t deadline = (int64_t)(deadline_secs * 1000000000);
+      int64_t cur = Internal::now_ns();
+
+      // Already late, nothing to measure.
+      if (cur >= deadline)
+         return;
+
+      int64_t wake = deadline - slack_ns;
+      if (wake > cur)
+      {
+         struct timespec ts;
+         ts.tv_sec = wake / 1000000000;
+         ts.tv_nsec = wake % 1000000000;
+         while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+
+         cur = Internal::now_ns();
+         if (cur > deadline)
+            oversleeps++;
+      }
+
+      while (cur < deadline)
+      {
+         if (deadline - cur > Internal::yield_threshold_ns)
+            std::this_thread::yield();
+         cur = Internal::now_ns();
+      }
+
+      uint64_t error = cur - deadline;
+      waits++;
+      total_error_ns += error;
+
+      uint64_t max = max_error_ns;
+      while (error > max && !max_error_ns.compare_exchange_weak(max, error));
+   }
+
+   PrecisionTimer::Stats PrecisionTimer::stats() const
+   {
+      Stats stats;
+      stats.waits = waits;
+      stats.mean_error = stats.waits ? (double)total_error_ns / stats.waits * 0.000000001 : 0.0;
+      stats.max_error = max_error_ns * 0.000000001;
+      stats.oversleeps = oversleeps;
+      return stats;
+   }
+}
@@ -0,0 +1,67 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TIMER_HPP
+#define __TIMER_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+namespace General
+{
+   // Waits for a deadline much more precisely than a plain sleep. The kernel is only trusted to wake us up
+   // some slack before the deadline, the rest is spent yielding and spinning.
+   // Deadlines are on CLOCK_MONOTONIC, which is what std::chrono::steady_clock uses as well.
+   class PrecisionTimer
+   {
+      public:
+         struct Stats
+         {
+            uint64_t waits;
+            // Seconds past the deadline we actually got back.
+            double mean_error;
+            double max_error;
+            // Times the kernel sleep alone already went past the deadline. If this happens a lot, the slack is too small.
+            uint64_t oversleeps;
+         };
+
+         PrecisionTimer(double slack = 0.0015);
+         void operator=(const PrecisionTimer&) = delete;
+         PrecisionTimer(const PrecisionTimer&) = delete;
+
+         void set_slack(double secs);
+         double slack() const;
+
+         static double now();
+         void sleep_until(double deadline);
+         void sleep(double secs);
+
+         Stats stats() const;
+
+      private:
+         std::atomic<int64_t> slack_ns;
+
+         std::atomic<uint64_t> waits;
+         std::atomic<uint64_t> total_error_ns;
+         std::atomic<uint64_t> max_error_ns;
+         std::atomic<uint64_t> oversleeps;
+   };
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Trace.hpp"
+#include "General.hpp"
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace General
+{
+   namespace Internal
+   {
+      // Keeps a forgotten --trace from eating all memory, 32 MiB per thread.
+      static const size_t max_events = 1 << 20;
+   }
+
+   thread_local Tracer::Buffer *Tracer::local = nullptr;
+
+   Tracer& Tracer::get()
+   {
+      static Tracer tracer;
+      return tracer;
+   }
+
+   Tracer::Tracer() : active(false), start_time(0.0)
+   {}
+
+   void Tracer::start(const std::string& in_path)
+   {
+      std::ofstream test(in_path.c_str());
+      if (!test)
+         throw std::runtime_error(General::join("Can't write trace to ", in_path, "\n"));
+
+      path = in_path;
+      start_time = PrecisionTimer::now();
+      active = true;
+   }
+
+   Tracer::Buffer& Tracer::buffer()
+   {
+      if (local)
+         return *local;
+
+      std::lock_guard<std::mutex> f(lock);
+      Buffer buf;
+      buf.tid = buffers.size() + 1;
+      buf.name = nullptr;
+      buf.dropped = 0;
+      buffers.push_back(std::move(buf));
+      buffers.back().events.reserve(4096);
+
+      local = &buffers.back();
+      return buffers.back();
+   }
+
+   void Tracer::record(const char *name, char phase, double time, double arg)
+   {
+      Buffer& buf = buffer();
+      if (buf.events.size() >= Internal::max_events)
+      {
+         buf.dropped++;
+         return;
+      }
+
+      Event event = { name, phase, time, arg };
+      buf.events.push_back(event);
+   }
+
+   void Tracer::name_thread(const char *name)
+   {
+      if (enabled())
+         buffer().name = name;
+   }
+
+   void Tracer::complete(const char *name, double start, double end)
+   {
+      if (enabled())
+         record(name, 'X', start, end - start);
+   }
+
+   void Tracer::instant(const char *name)
+   {
+      if (enabled())
+         record(name, 'i', PrecisionTimer::now(), 0.0);
+   }
+
+   void Tracer::counter(const char *name, double value)
+   {
+      if (enabled())
+         record(name, 'C', PrecisionTimer::now(), value);
+   }
+
+   void Tracer::finish()
+   {
+      if (!enabled())
+         return;
+      active = false;
+
+      std::lock_guard<std::mutex> f(lock);
+      std::ofstream out(path.c_str());
+      out.precision(3);
+      out << std::fixed;
+      out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+      bool first = true;
+      for (auto& buf : buffers)
+      {
+         if (buf.name)
+         {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buf.tid <<
+               ",\"args\":{\"name\":\"" << buf.name << "\"}}";
+            first = false;
+         }
+
+         for (auto& event : buf.events)
+         {
+            double ts = (event.time - start_time) * 1000000.0;
+            out << (first ? "" : ",\n") << "{\"name\":\"" << event.name << "\",\"ph\":\"" << event.phase <<
+               "\",\"pid\":1,\"tid\":" << buf.tid << ",\"ts\":" << ts;
+            first = false;
+
+            switch (event.phase)
+            {
+               case 'X':
+                  out << ",\"dur\":" << event.arg * 1000000.0;
+                  break;
+               case 'C':
+                  out << ",\"args\":{\"value\":" << event.arg << "}";
+                  break;
+               case 'i':
+                  out << ",\"s\":\"t\"";
+                  break;
+            }
+            out << "}";
+         }
+
+         if (buf.dropped)
+            std::cerr << "Trace buffer full, dropped " << buf.dropped << " events on thread " << buf.tid << "." << std::endl;
+      }
+
+      out << "\n]}\n";
+      buffers.clear();
+      local = nullptr;
+   }
+}
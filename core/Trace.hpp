@@ -0,0 +1,106 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __TRACE_HPP
+#define __TRACE_HPP
+
+#include "Timer.hpp"
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <vector>
+#include <string>
+
+namespace General
+{
+   // Records what each thread is doing, and writes it out in Chrome's trace event format (chrome://tracing, Perfetto).
+   // Every thread appends to a buffer of its own, so recording takes no locks. Nothing is recorded until start().
+   // Event names are kept as pointers, so they have to be string literals.
+   class Tracer
+   {
+      public:
+         static Tracer& get();
+
+         void operator=(const Tracer&) = delete;
+         Tracer(const Tracer&) = delete;
+
+         void start(const std::string& path);
+         bool enabled() const { return active.load(std::memory_order_relaxed); }
+         // Stops recording and writes out everything. Other threads shouldn't be recording anymore at this point.
+         void finish();
+
+         void name_thread(const char *name);
+         // A span on the calling thread, times from PrecisionTimer::now().
+         void complete(const char *name, double start, double end);
+         void instant(const char *name);
+         void counter(const char *name, double value);
+
+      private:
+         Tracer();
+
+         struct Event
+         {
+            const char *name;
+            char phase;
+            double time;
+            // Duration for spans, the value for counters.
+            double arg;
+         };
+
+         struct Buffer
+         {
+            unsigned tid;
+            const char *name;
+            std::vector<Event> events;
+            size_t dropped;
+         };
+
+         std::atomic<bool> active;
+         std::string path;
+         double start_time;
+
+         std::mutex lock;
+         std::list<Buffer> buffers;
+         static thread_local Buffer *local;
+
+         Buffer& buffer();
+         void record(const char *name, char phase, double time, double arg);
+   };
+
+   // Records a span from construction until it goes out of scope.
+   class TraceScope
+   {
+      public:
+         TraceScope(const char *in_name) : name(in_name), start(Tracer::get().enabled() ? PrecisionTimer::now() : -1.0) {}
+         ~TraceScope()
+         {
+            if (start >= 0.0)
+               Tracer::get().complete(name, start, PrecisionTimer::now());
+         }
+
+         void operator=(const TraceScope&) = delete;
+         TraceScope(const TraceScope&) = delete;
+
+      private:
+         const char *name;
+         double start;
+   };
+}
+
+#endif
@@ -20,8 +20,15 @@
 #include "FF.hpp"
 #include "AV.hpp"
 #include "Scheduler.hpp"
+#include "Budget.hpp"
+#include "Trace.hpp"
 #include <stdexcept>
+#include <algorithm>
 #include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
 #include "term/TermEvent.hpp"
 #include "term/TermInfoOutput.hpp"
 
@@ -30,25 +37,333 @@ using namespace AV;
 using namespace AV::Audio;
 using namespace AV::Video;
 
+static void print_usage(const char *argv0)
+{
+   std::cerr << "Usage: " << argv0 << " [options] file" << std::endl;
+   std::cerr << "   -m, --max-buffer-mb <mb>    Keep buffered packets, audio and subtitles within roughly this many MiB." << std::endl;
+   std::cerr << "   -p, --prefetch-mb <mb>      Size of the read-ahead buffer for local files (default 16)." << std::endl;
+   std::cerr << "   -P, --no-prefetch           Read files directly from the demuxer thread." << std::endl;
+   std::cerr << "   -M, --mmap                  Map local files into memory instead of reading them." << std::endl;
+   std::cerr << "   -I, --no-index              Don't build or use the cached keyframe index." << std::endl;
+   std::cerr << "   -t, --threads <n>           Video decoding threads (default: one per core)." << std::endl;
+   std::cerr << "   -a, --accurate-seek         Land seeks on the exact target instead of the nearest keyframe." << std::endl;
+   std::cerr << "   -s, --sync <clock>          Sync to audio (default), video or external." << std::endl;
+   std::cerr << "   -D, --no-drift-correction   Don't resample audio to follow a video or external clock." << std::endl;
+   std::cerr << "   -S, --timer-slack <ms>      Stop sleeping this long before a frame is due and spin instead (default 1.5)." << std::endl;
+   std::cerr << "   -A, --audio-device <name>   ALSA device to play on (default \"default\")." << std::endl;
+   std::cerr << "       --alsa-mmap             Write audio straight into the device's buffer, if the device allows it." << std::endl;
+   std::cerr << "       --audio-buffer-ms <ms>  Ask the audio device for this much buffering." << std::endl;
+   std::cerr << "       --audio-period-ms <ms>  Ask the audio device to wake us up this often." << std::endl;
+   std::cerr << "   -L, --low-latency           Small audio buffers, so seeking and pausing are heard right away." << std::endl;
+   std::cerr << "       --sched <thread>:<policy>" << std::endl;
+   std::cerr << "                               Scheduling for control, demux, decode, video or audio threads, e.g." << std::endl;
+   std::cerr << "                               audio:fifo:70,cpus=2 or decode:nice=5,cpus=4-7. Falls back to niceness if" << std::endl;
+   std::cerr << "                               real-time scheduling isn't allowed." << std::endl;
+   std::cerr << "       --mlock                 Lock all memory, so audio never waits on a page fault. Not with --mmap." << std::endl;
+   std::cerr << "   -B, --benchmark             Decode as fast as possible without audio or video output, then print a JSON report." << std::endl;
+   std::cerr << "       --benchmark-present     Like --benchmark, but still upload and show frames." << std::endl;
+   std::cerr << "   -T, --trace <file>          Record what every thread is doing to a Chrome trace (chrome://tracing)." << std::endl;
+   std::cerr << "   -h, --help                  Show this help." << std::endl;
+}
+
+// Rejects trailing garbage and anything out of [min, max], instead of quietly going with 0 or whatever strto*() made of it.
+static bool parse_integer(const char *arg, const char *what, long min, long max, long& out)
+{
+   char *end = nullptr;
+   out = strtol(arg, &end, 0);
+   if (*arg == '\0' || *end != '\0' || out < min || out > max)
+   {
+      std::cerr << "Invalid " << what << " \"" << arg << "\"." << std::endl;
+      return false;
+   }
+   return true;
+}
+
+static bool parse_number(const char *arg, const char *what, double min, double max, double& out)
+{
+   char *end = nullptr;
+   out = strtod(arg, &end);
+   if (*arg == '\0' || *end != '\0' || !(out >= min && out <= max))
+   {
+      std::cerr << "Invalid " << what << " \"" << arg << "\"." << std::endl;
+      return false;
+   }
+   return true;
+}
+
+// "audio:fifo:70,cpus=2"
+static bool parse_sched(const std::string& arg, AV::Scheduler::Options::Threads& threads)
+{
+   size_t colon = arg.find(':');
+   std::string name = arg.substr(0, colon);
+   General::ThreadPolicy *policy = nullptr;
+   if (name == "control")
+      policy = &threads.control;
+   else if (name == "demux")
+      policy = &threads.demux;
+   else if (name == "video")
+      policy = &threads.video;
+   else if (name == "decode")
+      policy = &threads.decode;
+   else if (name == "audio")
+      policy = &threads.audio;
+
+   if (!policy || colon == std::string::npos)
+      return false;
+
+   try
+   {
+      *policy = General::ThreadPolicy::parse(arg.substr(colon + 1));
+   }
+   catch (std::exception& e)
+   {
+      std::cerr << e.what();
+      return false;
+   }
+   return true;
+}
+
 int main(int argc, char *argv[])
 {
-   if (argc != 2)
+   static const struct option long_opts[] = {
+      { "max-buffer-mb", required_argument, nullptr, 'm' },
+      { "prefetch-mb", required_argument, nullptr, 'p' },
+      { "no-prefetch", no_argument, nullptr, 'P' },
+      { "mmap", no_argument, nullptr, 'M' },
+      { "no-index", no_argument, nullptr, 'I' },
+      { "threads", required_argument, nullptr, 't' },
+      { "accurate-seek", no_argument, nullptr, 'a' },
+      { "sync", required_argument, nullptr, 's' },
+      { "no-drift-correction", no_argument, nullptr, 'D' },
+      { "timer-slack", required_argument, nullptr, 'S' },
+      { "audio-device", required_argument, nullptr, 'A' },
+      { "alsa-mmap", no_argument, nullptr, 'X' },
+      { "audio-buffer-ms", required_argument, nullptr, 'U' },
+      { "audio-period-ms", required_argument, nullptr, 'R' },
+      { "low-latency", no_argument, nullptr, 'L' },
+      { "sched", required_argument, nullptr, 'Y' },
+      { "mlock", no_argument, nullptr, 'K' },
+      { "benchmark", no_argument, nullptr, 'B' },
+      { "benchmark-present", no_argument, nullptr, 'G' },
+      { "trace", required_argument, nullptr, 'T' },
+      { "help", no_argument, nullptr, 'h' },
+      { nullptr, 0, nullptr, 0 }
+   };
+
+   MediaFile::Options file_opts;
+   AV::Scheduler::Options sched_opts;
+   const char *trace_path = nullptr;
+   bool low_latency = false;
+
+   int c;
+   while ((c = getopt_long(argc, argv, "m:p:PMIt:as:DS:A:LBT:h", long_opts, nullptr)) != -1)
+   {
+      switch (c)
+      {
+         case 'm':
+         {
+            long mb;
+            if (!parse_integer(optarg, "buffer size", 1, 1L << 20, mb))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            General::MemoryBudget::get().set_limit((size_t)mb << 20);
+            break;
+         }
+
+         case 'p':
+         {
+            long mb;
+            if (!parse_integer(optarg, "prefetch size", 1, 4096, mb))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            file_opts.prefetch_size = (size_t)mb << 20;
+            break;
+         }
+
+         case 'P':
+            file_opts.prefetch = false;
+            break;
+
+         case 'M':
+            file_opts.mmap = true;
+            break;
+
+         case 'I':
+            file_opts.keyframe_index = false;
+            break;
+
+         // Same cap as the default, libavcodec doesn't go past 16.
+         case 't':
+         {
+            long threads;
+            if (!parse_integer(optarg, "thread count", 1, LONG_MAX, threads))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            file_opts.threads = std::min(threads, 16L);
+            break;
+         }
+
+         case 'a':
+            sched_opts.accurate_seek = true;
+            break;
+
+         case 's':
+            if (strcmp(optarg, "audio") == 0)
+               sched_opts.sync = AV::Scheduler::Sync::Audio;
+            else if (strcmp(optarg, "video") == 0)
+               sched_opts.sync = AV::Scheduler::Sync::Video;
+            else if (strcmp(optarg, "external") == 0)
+               sched_opts.sync = AV::Scheduler::Sync::External;
+            else
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            break;
+
+         case 'D':
+            sched_opts.drift_correction = false;
+            break;
+
+         case 'S':
+         {
+            double ms;
+            if (!parse_number(optarg, "timer slack", 0.0, 1000.0, ms))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            sched_opts.timer_slack = ms / 1000.0;
+            break;
+         }
+
+         case 'A':
+            sched_opts.audio_device.device = optarg;
+            break;
+
+         case 'X':
+            sched_opts.audio_device.mmap = true;
+            break;
+
+         // 0 would mean "whatever the device likes", so that's not something to ask for explicitly.
+         case 'U':
+         {
+            double ms;
+            if (!parse_number(optarg, "audio buffer time", 1.0, 10000.0, ms))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            sched_opts.audio_device.buffer_time = ms / 1000.0;
+            break;
+         }
+
+         case 'R':
+         {
+            double ms;
+            if (!parse_number(optarg, "audio period time", 1.0, 10000.0, ms))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            sched_opts.audio_device.period_time = ms / 1000.0;
+            break;
+         }
+
+         // Explicit sizes win, whichever order they come in.
+         case 'L':
+            low_latency = true;
+            break;
+
+         case 'Y':
+            if (!parse_sched(optarg, sched_opts.threads))
+            {
+               print_usage(argv[0]);
+               return 1;
+            }
+            break;
+
+         case 'K':
+            sched_opts.lock_memory = true;
+            break;
+
+         case 'B':
+            sched_opts.benchmark = true;
+            break;
+
+         case 'G':
+            sched_opts.benchmark = true;
+            sched_opts.benchmark_present = true;
+            break;
+
+         case 'T':
+            trace_path = optarg;
+            break;
+
+         case 'h':
+            print_usage(argv[0]);
+            return 0;
+
+         default:
+            print_usage(argv[0]);
+            return 1;
+      }
+   }
+
+   if (optind != argc - 1)
+   {
+      print_usage(argv[0]);
+      return 1;
+   }
+
+   // mlockall() would pin the whole mapped file as well, which is exactly what the memory budget is there to prevent.
+   if (sched_opts.lock_memory && file_opts.mmap)
    {
-      std::cerr << "Usage: " << argv[0] << " file" << std::endl;
+      std::cerr << "--mlock can't be combined with --mmap." << std::endl;
+      print_usage(argv[0]);
       return 1;
    }
 
+   if (low_latency)
+   {
+      if (sched_opts.audio_device.buffer_time <= 0.0)
+         sched_opts.audio_device.buffer_time = 0.04;
+      if (sched_opts.audio_device.period_time <= 0.0)
+         sched_opts.audio_device.period_time = 0.01;
+      sched_opts.audio_buffer = 0.1;
+   }
+
    try
    {
-      auto media_file = MediaFile::shared(argv[1]);
-      AV::Scheduler sched(media_file);
-      sched.add_event_handler(IO::TermEvent::shared());
-      sched.add_info_handler(IO::TermInfoOutput::shared());
+      if (trace_path)
+         General::Tracer::get().start(trace_path);
+
+      auto media_file = MediaFile::shared(argv[optind], file_opts);
+      AV::Scheduler sched(media_file, sched_opts);
+
+      // Benchmarks run unattended, and the report is the only thing on stdout.
+      if (!sched_opts.benchmark)
+      {
+         sched.add_event_handler(IO::TermEvent::shared());
+         sched.add_info_handler(IO::TermInfoOutput::shared());
+      }
 
       while (sched.active())
       {
          sched.run();
       }
+
+      if (sched_opts.benchmark)
+         sched.report(std::cout);
    }
    catch (std::exception &e) { std::cerr << e.what() << std::endl; }
+
+   // The scheduler has joined its threads by now.
+   General::Tracer::get().finish();
 }
@@ -70,6 +70,7 @@ Message ASSRenderer::create_message(ASS_Image *img)
 }
 
 ASSRenderer::ASSRenderer(const std::vector<std::pair<std::string, std::vector<char>>>& fonts, const std::vector<char>& ass_data, unsigned width, unsigned height)
+   : budget(General::MemoryBudget::get().component("subtitles"))
 {
    library = ass_library_init();
    ass_set_message_cb(library, Internal::ass_msg_cb, nullptr);
@@ -97,6 +98,7 @@ ASSRenderer::ASSRenderer(const std::vector<std::pair<std::string, std::vector<ch
 
 ASSRenderer::~ASSRenderer()
 {
+   budget.set(0);
    ass_free_track(track);
    ass_renderer_done(renderer);
    ass_library_done(library);
@@ -127,11 +129,14 @@ const ASSRenderer::ListType& ASSRenderer::msg_list(double pts)
    if (change)
    {
       active_list.clear();
+      size_t bytes = 0;
       while (img)
       {
          active_list.push_back(create_message(img));
+         bytes += active_list.back().data.size();
          img = img->next;
       }
+      budget.set(bytes);
    }
 
    return active_list;
@@ -29,6 +29,7 @@ extern "C"
 #include <memory>
 #include <string>
 #include "General.hpp"
+#include "Budget.hpp"
 #include "subtitle.hpp"
 #include <utility>
 #include <vector>
@@ -55,6 +56,7 @@ namespace AV
             ASS_Track *track;
 
             ListType active_list;
+            General::MemoryBudget::Component& budget;
 
             static Message create_message(ASS_Image *img);
       };
@@ -2,6 +2,10 @@
 #define __INFO_OUTPUT_HPP
 
 #include "General.hpp"
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
 
 namespace IO
 {
@@ -11,6 +15,34 @@ namespace IO
          DECL_SMART(InfoOutput);
          virtual ~InfoOutput() {}
          virtual void output(double video_pts, double audio_pts, bool show_video, bool show_audio) = 0;
+         // Frames thrown away because they were late, and frames the decoder skipped to keep up.
+         virtual void frame_stats(unsigned dropped, unsigned skipped) { (void)dropped; (void)skipped; }
+
+         // Estimated speed of the audio clock against the system clock, in seconds per second.
+         virtual void clock_stats(double audio_drift) { (void)audio_drift; }
+
+         // Time spent in one step of the pipeline, or waiting for a lock. All times in seconds.
+         struct StageInfo
+         {
+            std::string name;
+            uint64_t count;
+            double mean;
+            double p50;
+            double p99;
+         };
+         virtual void stage_stats(const std::vector<StageInfo>& stages) { (void)stages; }
+
+         // How far past their deadline frames were shown, in seconds, and how often the kernel alone overslept.
+         virtual void timer_stats(double mean_error, double max_error, uint64_t oversleeps) { (void)mean_error; (void)max_error; (void)oversleeps; }
+
+         // Bytes held by each buffer registered with the memory budget. A limit of 0 means unlimited.
+         struct MemoryInfo
+         {
+            std::string name;
+            size_t bytes;
+            size_t peak;
+         };
+         virtual void memory_stats(const std::vector<MemoryInfo>& components, size_t limit) { (void)components; (void)limit; }
    };
 }
 
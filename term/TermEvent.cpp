@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 using namespace IO;
 using namespace AV;
@@ -56,6 +57,11 @@ EventHandler::Event TermEvent::event()
    return event;
 }
 
+void TermEvent::attach(General::EventLoop& loop)
+{
+   loop.watch(0);
+}
+
 void TermEvent::poll()
 {
    struct pollfd fd = {0, POLLIN};
@@ -13,6 +13,7 @@ namespace IO
          TermEvent();
          void poll();
          EventHandler::Event event();
+         void attach(General::EventLoop& loop);
       private:
          EventHandler::Event current;
    };
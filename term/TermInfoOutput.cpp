@@ -3,6 +3,46 @@
 
 using namespace IO;
 
+TermInfoOutput::TermInfoOutput() : dropped(0), skipped(0), drift(0.0), timer_mean(0.0), timer_max(0.0), buffered(0), buffer_limit(0)
+{
+   slowest.count = 0;
+}
+
+void TermInfoOutput::stage_stats(const std::vector<StageInfo>& stages)
+{
+   slowest.count = 0;
+   for (auto& stage : stages)
+   {
+      if (stage.count > 0 && (slowest.count == 0 || stage.p99 > slowest.p99))
+         slowest = stage;
+   }
+}
+
+void TermInfoOutput::frame_stats(unsigned in_dropped, unsigned in_skipped)
+{
+   dropped = in_dropped;
+   skipped = in_skipped;
+}
+
+void TermInfoOutput::clock_stats(double audio_drift)
+{
+   drift = audio_drift;
+}
+
+void TermInfoOutput::timer_stats(double mean_error, double max_error, uint64_t)
+{
+   timer_mean = mean_error;
+   timer_max = max_error;
+}
+
+void TermInfoOutput::memory_stats(const std::vector<MemoryInfo>& components, size_t limit)
+{
+   buffered = 0;
+   for (auto& comp : components)
+      buffered += comp.bytes;
+   buffer_limit = limit;
+}
+
 void TermInfoOutput::output(double video_pts, double audio_pts, bool show_video, bool show_audio)
 {
    printf("\r");
@@ -12,6 +52,18 @@ void TermInfoOutput::output(double video_pts, double audio_pts, bool show_video,
       printf("  A: %7.2f", static_cast<float>(audio_pts));
    if (show_video && show_audio)
       printf("  Delta: %7.2f", static_cast<float>(video_pts - audio_pts));
+   if (show_audio && drift != 0.0)
+      printf("  Drift: %+.2f ms/s", drift * 1000.0);
+   if (dropped || skipped)
+      printf("  Dropped: %u  Skipped: %u", dropped, skipped);
+   if (slowest.count > 0)
+      printf("  Slowest: %s p50/p99 %.1f/%.1f ms", slowest.name.c_str(), slowest.p50 * 1000.0, slowest.p99 * 1000.0);
+   if (timer_max > 0.0)
+      printf("  Jitter: %.2f/%.2f ms", timer_mean * 1000.0, timer_max * 1000.0);
+   if (buffer_limit)
+      printf("  Buf: %.1f/%.1f MB", buffered / 1048576.0, buffer_limit / 1048576.0);
+   else if (buffered)
+      printf("  Buf: %.1f MB", buffered / 1048576.0);
    printf("         ");
    fflush(stdout);
 }
@@ -9,8 +9,25 @@ namespace IO
    {
       public:
          DECL_SMART(TermInfoOutput);
+         TermInfoOutput();
          void output(double video_pts, double audio_pts, bool show_video, bool show_audio);
+         void frame_stats(unsigned dropped, unsigned skipped);
+         void clock_stats(double audio_drift);
+         void stage_stats(const std::vector<StageInfo>& stages);
+         void timer_stats(double mean_error, double max_error, uint64_t oversleeps);
+         void memory_stats(const std::vector<MemoryInfo>& components, size_t limit);
          ~TermInfoOutput();
+
+      private:
+         unsigned dropped;
+         unsigned skipped;
+         double drift;
+         // There's only room for one on the line, so show whichever stage has the worst tail.
+         StageInfo slowest;
+         double timer_mean;
+         double timer_max;
+         size_t buffered;
+         size_t buffer_limit;
    };
 }
 
@@ -0,0 +1,51 @@
+/*
+ *  SLIMPlayer - Simple and Lightweight Media Player
+ *  Copyright (C) 2010 - Hans-Kristian Arntzen
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VIDEO_NULL_HPP
+#define __VIDEO_NULL_HPP
+
+#include "display.hpp"
+
+namespace AV
+{
+   namespace Video
+   {
+      // Throws every frame away. For running without a window, e.g. benchmarking.
+      class Null : public Display, private General::SmartDefs<Null>
+      {
+         public:
+            DECL_SMART(Null);
+            Null(unsigned in_width, unsigned in_height) : width(in_width), height(in_height) {}
+
+            void frame(const uint8_t * const *, const int *, int, int) {}
+            void subtitle(const Sub::Message&) {}
+            void flip() {}
+            void toggle_fullscreen() {}
+            void get_rect(unsigned& in_width, unsigned& in_height)
+            {
+               in_width = width;
+               in_height = height;
+            }
+
+         private:
+            unsigned width, height;
+      };
+   }
+}
+
+#endif
@@ -159,7 +159,7 @@ unsigned GL::current_x = 0;
 unsigned GL::current_y = 0;
 
 GL::GL(unsigned in_width, unsigned in_height, float in_aspect_ratio, int pix_fmt)
-   : width(in_width), height(in_height), fullscreen(false), do_fullscreen(false)
+   : width(in_width), height(in_height), fullscreen(false), do_fullscreen(false), budget(General::MemoryBudget::get().component("gl textures"))
 {
    if (SDL_Init(SDL_INIT_VIDEO) < 0)
       throw std::runtime_error("Couldn't init SDL.");
@@ -211,6 +211,7 @@ GL::GL(unsigned in_width, unsigned in_height, float in_aspect_ratio, int pix_fmt
       glTexImage2D(GL_TEXTURE_2D,
             0, GL_LUMINANCE8, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, &tmp[0]);
    }
+   budget.add(3 * width * height);
 
    glEnableClientState(GL_VERTEX_ARRAY);
    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -362,6 +363,7 @@ void GL::flip()
 
 GL::~GL()
 {
+   budget.sub(3 * width * height);
    SDL_Quit();
 }
 
@@ -452,9 +454,14 @@ namespace Internal
    };
 }
 
-GLEvent::GLEvent() : thread_id(std::this_thread::get_id()), cur_evnt(EventHandler::Event::None)
+GLEvent::GLEvent() : thread_id(std::this_thread::get_id()), cur_evnt(EventHandler::Event::None), loop(nullptr)
 {}
 
+void GLEvent::attach(General::EventLoop& in_loop)
+{
+   loop = &in_loop;
+}
+
 void GLEvent::poll()
 {
    if (thread_id == std::this_thread::get_id())
@@ -490,6 +497,10 @@ void GLEvent::poll()
                break;
          }
       }
+
+      // SDL has nothing to wait on, so we're polled from the video thread, and have to wake up the control thread ourselves.
+      if (cur_evnt != EventHandler::Event::None && loop)
+         loop->notify();
    }
 }
 
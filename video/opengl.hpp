@@ -22,6 +22,7 @@
 
 #include "display.hpp"
 #include "AV.hpp"
+#include "Budget.hpp"
 
 #include "subs/subtitle.hpp"
 
@@ -60,6 +61,7 @@ namespace Video {
          bool do_fullscreen;
 
          GLuint gl_tex[4];
+         General::MemoryBudget::Component& budget;
          unsigned subsamp_log2[3][2];
 
          void init_glsl(int pix_fmt);
@@ -81,9 +83,11 @@ namespace Video {
          GLEvent();
          Event event();
          void poll();
+         void attach(General::EventLoop& loop);
       private:
          std::thread::id thread_id;
          EventHandler::Event cur_evnt;
+         General::EventLoop *loop;
    };
 
 }}